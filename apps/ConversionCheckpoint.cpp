@@ -0,0 +1,306 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+
+#include "ConversionCheckpoint.h"
+#include "Utils.h"
+#include "ospcommon/tasking/parallel_for.h"
+#include "ospcommon/xml/XML.h"
+
+static const uint64_t FNV_OFFSET = 0xcbf29ce484222325ull;
+static const uint64_t FNV_PRIME  = 0x100000001b3ull;
+static const size_t CHECKSUM_CHUNK = size_t(64) << 20;
+
+static inline uint64_t fnv1a(uint64_t h, const uint8_t *p, size_t n)
+{
+  for (size_t i = 0; i < n; i++) {
+    h ^= p[i];
+    h *= FNV_PRIME;
+  }
+  return h;
+}
+
+uint64_t checksumBuffer(const void *data, size_t numBytes)
+{
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  const size_t numChunks = (numBytes + CHECKSUM_CHUNK - 1) / CHECKSUM_CHUNK;
+  std::vector<uint64_t> chunkHash(numChunks);
+
+  tasking::parallel_for(numChunks, [&](size_t c) {
+    size_t begin = c * CHECKSUM_CHUNK;
+    size_t end   = std::min(numBytes, begin + CHECKSUM_CHUNK);
+    chunkHash[c] = fnv1a(FNV_OFFSET, bytes + begin, end - begin);
+  });
+
+  uint64_t h = fnv1a(FNV_OFFSET,
+                     reinterpret_cast<const uint8_t *>(&numBytes),
+                     sizeof(numBytes));
+  return fnv1a(h,
+               reinterpret_cast<const uint8_t *>(chunkHash.data()),
+               chunkHash.size() * sizeof(uint64_t));
+}
+
+uint64_t checksumFile(const std::string &fileName, size_t *numBytes)
+{
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("could not open " + fileName);
+
+  struct stat statBuf = {0};
+  fstat(fd, &statBuf);
+  const size_t size = statBuf.st_size;
+  if (numBytes)
+    *numBytes = size;
+
+  if (size == 0) {
+    close(fd);
+    return checksumBuffer(NULL, 0);
+  }
+
+  void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+    throw std::runtime_error("could not map " + fileName);
+  madvise(mapping, size, MADV_SEQUENTIAL);
+
+  uint64_t h = checksumBuffer(mapping, size);
+  munmap(mapping, size);
+  return h;
+}
+
+ConversionCheckpoint::ConversionCheckpoint(const std::string &outputFile,
+                                           bool resume)
+    : dir(outputFile + ".ckpt"),
+      manifestFile(outputFile + ".ckpt/manifest.xml"),
+      resume(resume)
+{
+  if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+    throw std::runtime_error("could not create checkpoint directory " + dir);
+
+  if (resume)
+    readManifest();
+  else
+    writeManifest();
+}
+
+void ConversionCheckpoint::readManifest()
+{
+  struct stat statBuf;
+  if (stat(manifestFile.c_str(), &statBuf) != 0) {
+    std::cout << yellow << "No checkpoint manifest found in " << dir
+              << ", starting from scratch" << reset << "\n";
+    return;
+  }
+
+  std::shared_ptr<xml::XMLDoc> doc = xml::readXML(manifestFile.c_str());
+  if (!doc)
+    throw std::runtime_error("could not read checkpoint manifest:" +
+                             manifestFile);
+  const xml::Node &osprayNode = doc->child[0];
+  assert(osprayNode.name == "ospray");
+
+  for (const xml::Node &node : osprayNode.child) {
+    if (node.name == "Input")
+      inputChecksum = std::stoull(node.getProp("checksum"), NULL, 16);
+    if (node.name != "Entry")
+      continue;
+    Entry e;
+    e.stage    = node.getProp("stage");
+    e.file     = node.getProp("file");
+    e.bytes    = std::stoull(node.getProp("bytes"));
+    e.checksum = std::stoull(node.getProp("checksum"), NULL, 16);
+    entries.push_back(e);
+  }
+
+  validateStages();
+}
+
+void ConversionCheckpoint::validateStages()
+{
+  std::set<std::string> invalid;
+  for (const Entry &e : entries) {
+    if (invalid.count(e.stage))
+      continue;
+    struct stat statBuf;
+    if (stat(e.file.c_str(), &statBuf) != 0 ||
+        size_t(statBuf.st_size) != e.bytes ||
+        checksumFile(e.file) != e.checksum) {
+      std::cout << red << "Checkpoint of stage '" << e.stage
+                << "' is invalid: " << e.file << reset << "\n";
+      invalid.insert(e.stage);
+    }
+  }
+
+  validStages.clear();
+  for (const Entry &e : entries) {
+    if (!invalid.count(e.stage))
+      validStages.insert(e.stage);
+  }
+}
+
+void ConversionCheckpoint::writeManifest()
+{
+  // write to a temporary file first so a kill never leaves a torn manifest
+  const std::string tmpFile = manifestFile + ".tmp";
+  FILE *manifest = fopen(tmpFile.c_str(), "w");
+  if (!manifest)
+    throw std::runtime_error("could not write " + tmpFile);
+
+  fprintf(manifest, "<?xml?>\n");
+  fprintf(manifest, "<ospray>\n");
+  if (inputChecksum) {
+    fprintf(manifest,
+            "  <Input checksum=\"%016llx\">\n",
+            (unsigned long long)inputChecksum);
+    fprintf(manifest, "  </Input>\n");
+  }
+  for (const Entry &e : entries) {
+    fprintf(manifest,
+            "  <Entry stage=\"%s\" file=\"%s\" bytes=\"%zu\" "
+            "checksum=\"%016llx\">\n",
+            e.stage.c_str(),
+            e.file.c_str(),
+            e.bytes,
+            (unsigned long long)e.checksum);
+    fprintf(manifest, "  </Entry>\n");
+  }
+  fprintf(manifest, "</ospray>\n");
+  fflush(manifest);
+  fsync(fileno(manifest));
+  fclose(manifest);
+
+  if (rename(tmpFile.c_str(), manifestFile.c_str()) != 0)
+    throw std::runtime_error("could not update " + manifestFile);
+}
+
+bool ConversionCheckpoint::validateInput(const std::string &fingerprint)
+{
+  const uint64_t checksum = checksumBuffer(fingerprint.data(), fingerprint.size());
+
+  std::lock_guard<std::mutex> guard(lock);
+  const bool matches = checksum == inputChecksum;
+  if (!matches) {
+    if (resume && !entries.empty()) {
+      std::cout << red << "Checkpoint in " << dir
+                << " was written for other inputs, starting from scratch"
+                << reset << "\n";
+    }
+    entries.clear();
+    validStages.clear();
+    inputChecksum = checksum;
+    writeManifest();
+  }
+  return matches;
+}
+
+bool ConversionCheckpoint::isStageDone(const std::string &stage)
+{
+  if (!resume)
+    return false;
+
+  std::lock_guard<std::mutex> guard(lock);
+  const bool found = validStages.count(stage) != 0;
+  if (found)
+    std::cout << cyan << "Skipping finished stage '" << stage << "'" << reset
+              << "\n";
+  return found;
+}
+
+void ConversionCheckpoint::markStageDone(const std::string &stage,
+                                         const std::vector<std::string> &files)
+{
+  std::vector<Entry> stageEntries;
+  for (const std::string &f : files) {
+    Entry e;
+    e.stage    = stage;
+    e.file     = f;
+    e.checksum = checksumFile(f, &e.bytes);
+    stageEntries.push_back(e);
+  }
+
+  std::lock_guard<std::mutex> guard(lock);
+  entries.erase(std::remove_if(entries.begin(),
+                               entries.end(),
+                               [&](const Entry &e) { return e.stage == stage; }),
+                entries.end());
+  entries.insert(entries.end(), stageEntries.begin(), stageEntries.end());
+  validStages.insert(stage);
+  writeManifest();
+}
+
+void ConversionCheckpoint::clear()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  entries.clear();
+  validStages.clear();
+  writeManifest();
+}
+
+void ConversionCheckpoint::remove()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  // only the subtrees live in the directory, the other stages record the
+  // conversion outputs themselves
+  for (const Entry &e : entries) {
+    if (e.file.compare(0, dir.size() + 1, dir + "/") == 0)
+      unlink(e.file.c_str());
+  }
+  entries.clear();
+  validStages.clear();
+  unlink(manifestFile.c_str());
+  if (rmdir(dir.c_str()) != 0)
+    std::cout << yellow << "Could not remove " << dir << reset << "\n";
+}
+
+std::string ConversionCheckpoint::subtreeFile(int octant) const
+{
+  return dir + "/subtree" + std::to_string(octant) + ".octbin";
+}
+
+bool ConversionCheckpoint::loadSubtree(int octant,
+                                       std::vector<VoxelOctreeNode> &nodes)
+{
+  const std::string stage = "subtree" + std::to_string(octant);
+  if (!isStageDone(stage))
+    return false;
+
+  const std::string fileName = subtreeFile(octant);
+  FILE *file = fopen(fileName.c_str(), "rb");
+  if (!file)
+    return false;
+
+  fseek(file, 0, SEEK_END);
+  size_t numNodes = ftell(file) / sizeof(VoxelOctreeNode);
+  fseek(file, 0, SEEK_SET);
+
+  nodes.resize(numNodes);
+  size_t numRead = fread(nodes.data(), sizeof(VoxelOctreeNode), numNodes, file);
+  fclose(file);
+  return numNodes > 0 && numRead == numNodes;
+}
+
+void ConversionCheckpoint::saveSubtree(int octant,
+                                       const std::vector<VoxelOctreeNode> &nodes)
+{
+  const std::string fileName = subtreeFile(octant);
+  FILE *file = fopen(fileName.c_str(), "wb");
+  if (!file)
+    throw std::runtime_error("could not write " + fileName);
+
+  if (!fwrite(nodes.data(), sizeof(VoxelOctreeNode), nodes.size(), file))
+    throw std::runtime_error("Could not write " + fileName);
+  fflush(file);
+  fsync(fileno(file));
+  fclose(file);
+
+  markStageDone("subtree" + std::to_string(octant), {fileName});
+}
@@ -0,0 +1,75 @@
+// ======================================================================== //
+// Copyright SCI Institute, University of Utah, 2018
+// ======================================================================== //
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "../ospray/VoxelOctree.h"
+
+//! chunked FNV-1a, the chunk hashes are computed in parallel and folded in
+//! order, so a buffer and the file it was written to hash identically
+uint64_t checksumBuffer(const void *data, size_t numBytes);
+uint64_t checksumFile(const std::string &fileName, size_t *numBytes = NULL);
+
+/*! Tracks the finished stages of an ospRaw2Octree run in
+ * '<output>.ckpt/manifest.xml'. Every entry records a file produced by a
+ * stage together with its size and checksum, a stage only counts as done on
+ * a resumed run if all of its files still match. They are checksummed once
+ * when the manifest is read, not on every query. The root subtrees of the
+ * octree build are stored in the same directory. */
+class ConversionCheckpoint : public OctreeSubtreeStore
+{
+ public:
+  ConversionCheckpoint(const std::string &outputFile, bool resume);
+
+  /*! compare a description of the conversion inputs (files, grid, mode)
+   * with the one the checkpoint was written for. On a mismatch every entry
+   * is dropped, since the recorded stages were built from other data even
+   * if their files still validate. Returns true if the inputs match. */
+  bool validateInput(const std::string &fingerprint);
+
+  //! true if 'stage' was recorded and all of its files validated
+  bool isStageDone(const std::string &stage);
+  //! record 'stage' as finished, checksumming each of its output files
+  void markStageDone(const std::string &stage,
+                     const std::vector<std::string> &files);
+  //! drop every entry, used when an early stage has to be redone
+  void clear();
+  //! delete the checkpoint directory once the conversion has finished
+  void remove();
+
+  bool loadSubtree(int octant, std::vector<VoxelOctreeNode> &nodes) override;
+  void saveSubtree(int octant,
+                   const std::vector<VoxelOctreeNode> &nodes) override;
+
+ private:
+  struct Entry
+  {
+    std::string stage;
+    std::string file;
+    size_t bytes;
+    uint64_t checksum;
+  };
+
+  void readManifest();
+  //! fill validStages from the entries read from the manifest
+  void validateStages();
+  void writeManifest();
+  std::string subtreeFile(int octant) const;
+
+  std::string dir;
+  std::string manifestFile;
+  bool resume;
+  //! checksum of the validateInput() fingerprint, 0 if none was recorded
+  uint64_t inputChecksum{0};
+  std::vector<Entry> entries;
+  //! stages whose files all matched their entries, or were just recorded
+  std::set<std::string> validStages;
+  std::mutex lock;
+};
@@ -0,0 +1,454 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+
+#include "ConversionPipeline.h"
+#include "Utils.h"
+#include "ospcommon/tasking/parallel_for.h"
+#include "tbb/flow_graph.h"
+#include "tbb/parallel_sort.h"
+
+static const size_t PIPELINE_CHUNK_SIZE = size_t(1) << 20;
+//! chunks between the reader and the .vxl writer, bounds the buffered input
+static const size_t PIPELINE_MAX_CHUNKS = 8;
+
+//! integer extent, finest level and value range of a set of cells
+struct CellExtent
+{
+  int minLevel = std::numeric_limits<int>::max();
+  vec3i lower  = vec3i(std::numeric_limits<int>::max());
+  vec3i upper  = vec3i(std::numeric_limits<int>::min());
+  range1f vRange;
+
+  void extend(const vec3i &cellLower, int level, float value)
+  {
+    minLevel = std::min(minLevel, level);
+    lower    = min(lower, cellLower);
+    upper    = max(upper, cellLower + vec3i(1 << level));
+    vRange.extend(value);
+  }
+
+  void join(const CellExtent &other)
+  {
+    minLevel = std::min(minLevel, other.minLevel);
+    lower    = min(lower, other.lower);
+    upper    = max(upper, other.upper);
+    vRange.extend(other.vRange);
+  }
+};
+
+struct ConversionPipeline::Chunk
+{
+  size_t index;
+  size_t begin;
+  size_t count;
+  std::vector<OctreeCell> hexes;
+  std::vector<float> values;
+  CellExtent extent;
+};
+
+struct ConversionPipeline::Subtree
+{
+  //! position among the root children
+  size_t index;
+  //! empty if the root child is a single cell
+  std::vector<VoxelOctreeNode> nodes;
+  float leafValue;
+};
+
+//! adds the lifetime of a stage body to the busy time of the stage
+class StageTimer
+{
+ public:
+  StageTimer(std::atomic<int64_t> &busyMicros)
+      : busyMicros(busyMicros), t1(Time())
+  {
+  }
+  ~StageTimer()
+  {
+    busyMicros += int64_t(Time(t1) * 1e6);
+  }
+
+ private:
+  std::atomic<int64_t> &busyMicros;
+  time_point t1;
+};
+
+static void readFully(
+    int fd, void *dst, size_t bytes, size_t offset, const std::string &what)
+{
+  char *p = static_cast<char *>(dst);
+  while (bytes > 0) {
+    ssize_t n = pread(fd, p, bytes, offset);
+    if (n <= 0)
+      throw std::runtime_error("could not read " + what);
+    p += n;
+    bytes -= n;
+    offset += n;
+  }
+}
+
+ConversionPipeline::ConversionPipeline(exajetSource &source,
+                                       OctreeSubtreeStore *subtreeStore)
+    : source(source), subtreeStore(subtreeStore), rootLevel(0)
+{
+  hexFd = open(source.filePath.c_str(), O_RDONLY);
+  if (hexFd < 0)
+    throw std::runtime_error("could not open hexahedron file " +
+                             source.filePath.str());
+  const FileName fieldFile = source.filePath.path() + source.fieldName;
+  fieldFd                  = open(fieldFile.c_str(), O_RDONLY);
+  if (fieldFd < 0) {
+    close(hexFd);
+    throw std::runtime_error("could not open field file " + fieldFile.str());
+  }
+  posix_fadvise(hexFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  posix_fadvise(fieldFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  struct stat statBuf = {0};
+  fstat(hexFd, &statBuf);
+  numHexes = statBuf.st_size / sizeof(OctreeCell);
+  fstat(fieldFd, &statBuf);
+  if (size_t(statBuf.st_size) / sizeof(float) < numHexes) {
+    close(hexFd);
+    close(fieldFd);
+    throw std::runtime_error("field " + source.fieldName +
+                             " has fewer values than there are hexahedra");
+  }
+
+  readStats.name   = "read";
+  readStats.unit   = "MB";
+  keyStats.name    = "key";
+  keyStats.unit    = "Mcells";
+  voxelStats.name  = "write .vxl";
+  voxelStats.unit  = "MB";
+  sortStats.name   = "sort";
+  sortStats.unit   = "Mcells";
+  emitStats.name   = "emit";
+  emitStats.unit   = "Mnodes";
+  writeStats.name  = "write .octbin";
+  writeStats.unit  = "MB";
+}
+
+ConversionPipeline::~ConversionPipeline()
+{
+  close(hexFd);
+  close(fieldFd);
+}
+
+void ConversionPipeline::run(const std::string &voxelFile,
+                             const std::string &octreeFile)
+{
+  std::cout << yellow << "Pipelined conversion of "
+            << source.filePath.base() << "\t"
+            << "Field: " << source.fieldName << "\t"
+            << "#Voxels: " << numHexes << reset << "\n";
+  if (numHexes < 2)
+    throw std::runtime_error("need at least two hexahedra to convert");
+
+  time_point t1 = Time();
+  ingest(voxelFile);
+  sortCells();
+  emit(octreeFile);
+  report(Time(t1));
+}
+
+void ConversionPipeline::ingest(const std::string &voxelFile)
+{
+  typedef std::shared_ptr<Chunk> ChunkPtr;
+
+  const std::string voxlBinFile = voxelFile + ".vxl";
+  FILE *voxelsFile              = fopen(voxlBinFile.c_str(), "wb");
+  if (!voxelsFile)
+    throw std::runtime_error("Could not write" + voxlBinFile);
+
+  const vec3i gridMin     = source.exaJetGridMin;
+  const float voxelScale  = source.exaJetVoxelScale;
+  const vec3f worldOrigin = source.exaJetWorldOrigin;
+
+  // keys are taken on the level 0 grid, the finest level is only known
+  // once every chunk went through
+  cells.resize(numHexes);
+  CellExtent extent;
+
+  std::mutex lock;
+  std::condition_variable chunkDone;
+  size_t inFlight = 0;
+
+  tbb::flow::graph g;
+
+  tbb::flow::function_node<ChunkPtr, ChunkPtr> read(
+      g, tbb::flow::serial, [&](ChunkPtr c) {
+        StageTimer timer(readStats.busyMicros);
+        c->hexes.resize(c->count);
+        c->values.resize(c->count);
+        readFully(hexFd,
+                  c->hexes.data(),
+                  c->count * sizeof(OctreeCell),
+                  c->begin * sizeof(OctreeCell),
+                  source.filePath.str());
+        readFully(fieldFd,
+                  c->values.data(),
+                  c->count * sizeof(float),
+                  c->begin * sizeof(float),
+                  source.fieldName);
+        readStats.amount += c->count * (sizeof(OctreeCell) + sizeof(float));
+        return c;
+      });
+
+  tbb::flow::function_node<ChunkPtr, ChunkPtr> key(
+      g, tbb::flow::unlimited, [&](ChunkPtr c) {
+        StageTimer timer(keyStats.busyMicros);
+        for (size_t i = 0; i < c->count; i++) {
+          const vec3i lower = c->hexes[i].gridLower(gridMin, 0);
+          cells[c->begin + i].key   = mortonKey(lower);
+          cells[c->begin + i].value = c->values[i];
+          c->extent.extend(lower, c->hexes[i].level, c->values[i]);
+        }
+        keyStats.amount += c->count;
+        return c;
+      });
+
+  tbb::flow::sequencer_node<ChunkPtr> inOrder(
+      g, [](const ChunkPtr &c) { return c->index; });
+
+  tbb::flow::function_node<ChunkPtr> writeVoxels(
+      g, tbb::flow::serial, [&](ChunkPtr c) {
+        {
+          StageTimer timer(voxelStats.busyMicros);
+          // same world space voxels as exajetSource::parseData()
+          std::vector<voxel> voxels(c->count);
+          for (size_t i = 0; i < c->count; i++) {
+            const OctreeCell &h = c->hexes[i];
+            vec3f lower = vec3f(h.lower - gridMin) * voxelScale + worldOrigin;
+            float width = (1 << h.level) * voxelScale;
+            voxels[i]   = voxel(lower, width, c->values[i]);
+          }
+          if (fwrite(voxels.data(), sizeof(voxel), c->count, voxelsFile) !=
+              c->count)
+            throw std::runtime_error("Could not write" + voxlBinFile);
+          voxelStats.amount += c->count * sizeof(voxel);
+          extent.join(c->extent);
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+        inFlight--;
+        chunkDone.notify_one();
+        return tbb::flow::continue_msg();
+      });
+
+  tbb::flow::make_edge(read, key);
+  tbb::flow::make_edge(key, inOrder);
+  tbb::flow::make_edge(inOrder, writeVoxels);
+
+  const size_t numChunks =
+      (numHexes + PIPELINE_CHUNK_SIZE - 1) / PIPELINE_CHUNK_SIZE;
+  for (size_t i = 0; i < numChunks && !g.is_cancelled(); i++) {
+    {
+      // a failing stage cancels the graph and never frees its chunk
+      std::unique_lock<std::mutex> l(lock);
+      while (inFlight >= PIPELINE_MAX_CHUNKS && !g.is_cancelled())
+        chunkDone.wait_for(l, std::chrono::milliseconds(100));
+      inFlight++;
+    }
+    ChunkPtr c = std::make_shared<Chunk>();
+    c->index   = i;
+    c->begin   = i * PIPELINE_CHUNK_SIZE;
+    c->count   = std::min(PIPELINE_CHUNK_SIZE, numHexes - c->begin);
+    read.try_put(c);
+  }
+
+  try {
+    g.wait_for_all();
+  } catch (...) {
+    fclose(voxelsFile);
+    throw;
+  }
+  fclose(voxelsFile);
+
+  if (extent.lower.x < 0 || extent.lower.y < 0 || extent.lower.z < 0)
+    throw std::runtime_error("hexahedra below the grid minimum of " +
+                             source.filePath.str());
+  if (reduce_max(extent.upper) > (1 << 21))
+    throw std::runtime_error("grid exceeds the 21 bit Morton keys");
+
+  const int minLevel = extent.minLevel;
+  source.minLevel    = minLevel;
+  source.dimensions  = vec3i(extent.upper.x >> minLevel,
+                            extent.upper.y >> minLevel,
+                            extent.upper.z >> minLevel);
+  source.gridOrigin     = vec3f(0.f);
+  source.gridWorldSpace = vec3f((1 << minLevel) * voxelScale);
+  source.worldOrigin    = worldOrigin;
+  source.voxelRange     = extent.vRange;
+  source.voxelNum       = numHexes;
+  PRINT(minLevel);
+  PRINT(source.voxelRange);
+
+  const float virtualSize = max(max(roundToPow2(float(source.dimensions.x)),
+                                    roundToPow2(float(source.dimensions.y))),
+                                roundToPow2(float(source.dimensions.z)));
+  rootLevel = 0;
+  while ((1 << rootLevel) < int(virtualSize))
+    rootLevel++;
+}
+
+void ConversionPipeline::sortCells()
+{
+  StageTimer timer(sortStats.busyMicros);
+
+  // the cells are aligned to their level, so on the octree grid every key
+  // loses exactly the 3 * minLevel low bits
+  const int shift = 3 * source.minLevel;
+  if (shift > 0) {
+    tasking::parallel_for(numHexes, [&](size_t i) { cells[i].key >>= shift; });
+  }
+  tbb::parallel_sort(cells.begin(), cells.end());
+  sortStats.amount += numHexes;
+}
+
+void ConversionPipeline::emit(const std::string &octreeFile)
+{
+  typedef std::shared_ptr<Subtree> SubtreePtr;
+
+  const MortonCell *octantBegin[9];
+  VoxelOctree::partitionOctants(
+      cells.data(), cells.data() + numHexes, rootLevel - 1, octantBegin);
+
+  int childCount = 0;
+  int childIndice[8];
+  uint32_t childMask = 0;
+  for (int i = 0; i < 8; i++) {
+    if (octantBegin[i + 1] != octantBegin[i]) {
+      childMask |= 1 << i;
+      childIndice[childCount++] = i;
+    }
+  }
+
+  // the root and its children go first, they are rewritten once the
+  // offsets of all subtrees are known
+  std::vector<VoxelOctreeNode> top(1 + childCount, VoxelOctreeNode());
+  top[0].childDescripteOrValue = 0x100 | childMask;
+
+  const std::string binFileName = octreeFile + ".octbin";
+  FILE *bin                     = fopen(binFileName.c_str(), "wb");
+  if (!bin)
+    throw std::runtime_error("Could not write " + binFileName);
+  fwrite(top.data(), sizeof(VoxelOctreeNode), top.size(), bin);
+  size_t nodeNum = top.size();
+
+  tbb::flow::graph g;
+
+  tbb::flow::function_node<size_t, SubtreePtr> emitSubtree(
+      g, tbb::flow::unlimited, [&](size_t i) {
+        StageTimer timer(emitStats.busyMicros);
+        SubtreePtr subtree   = std::make_shared<Subtree>();
+        subtree->index       = i;
+        const int idx        = childIndice[i];
+        const MortonCell *b  = octantBegin[idx];
+        const MortonCell *e  = octantBegin[idx + 1];
+        if (e - b == 1) {
+          subtree->leafValue = b->value;
+          return subtree;
+        }
+
+        if (subtreeStore && subtreeStore->loadSubtree(idx, subtree->nodes)) {
+          VoxelOctree::updateNodeRanges(subtree->nodes);
+        } else {
+          subtree->nodes.resize(1);
+          subtree->nodes[0].vRange = VoxelOctree::buildSortedSubtree(
+              subtree->nodes, 0, b, e, rootLevel - 2);
+          if (subtreeStore)
+            subtreeStore->saveSubtree(idx, subtree->nodes);
+        }
+        emitStats.amount += subtree->nodes.size();
+        return subtree;
+      });
+
+  tbb::flow::sequencer_node<SubtreePtr> inOrder(
+      g, [](const SubtreePtr &s) { return s->index; });
+
+  tbb::flow::function_node<SubtreePtr> writeSubtree(
+      g, tbb::flow::serial, [&](SubtreePtr subtree) {
+        StageTimer timer(writeStats.busyMicros);
+        const size_t childIndex = 1 + subtree->index;
+        VoxelOctreeNode &child  = top[childIndex];
+        if (subtree->nodes.empty()) {
+          child.isLeaf = 1;
+          child.childDescripteOrValue =
+              doulbeBitsToUint((double)subtree->leafValue);
+          child.vRange = range1f(subtree->leafValue);
+        } else {
+          // same relocation as VoxelOctree::attachSubtree()
+          child.childDescripteOrValue =
+              (subtree->nodes[0].childDescripteOrValue & 0xFF) |
+              ((nodeNum - childIndex) << 8);
+          child.vRange = subtree->nodes[0].vRange;
+
+          const size_t n = subtree->nodes.size() - 1;
+          if (fwrite(subtree->nodes.data() + 1, sizeof(VoxelOctreeNode), n, bin) !=
+              n)
+            throw std::runtime_error("Could not write " + binFileName);
+          nodeNum += n;
+          writeStats.amount += n * sizeof(VoxelOctreeNode);
+        }
+        top[0].vRange.extend(child.vRange);
+        return tbb::flow::continue_msg();
+      });
+
+  tbb::flow::make_edge(emitSubtree, inOrder);
+  tbb::flow::make_edge(inOrder, writeSubtree);
+
+  for (int i = 0; i < childCount; i++)
+    emitSubtree.try_put(size_t(i));
+
+  try {
+    g.wait_for_all();
+  } catch (...) {
+    fclose(bin);
+    throw;
+  }
+
+  fseek(bin, 0, SEEK_SET);
+  fwrite(top.data(), sizeof(VoxelOctreeNode), top.size(), bin);
+  fclose(bin);
+
+  std::vector<MortonCell>().swap(cells);
+
+  VoxelOctree header;
+  header._actualBounds  = box3f(source.gridOrigin, vec3f(source.dimensions));
+  header._virtualBounds = box3f(vec3f(0.f), vec3f(float(1 << rootLevel)));
+  header._gridWorldSpace = source.gridWorldSpace;
+  header.saveOctreeHeader(octreeFile + ".oct", nodeNum);
+  std::cout << "Save octree into " << octreeFile << ".oct (" << nodeNum
+            << " nodes)\n";
+}
+
+void ConversionPipeline::report(double wallTime)
+{
+  std::cout << cyan << "Pipelined conversion: " << wallTime << " s"
+            << reset << "\n";
+  const StageStats *stages[] = {
+      &readStats, &keyStats, &voxelStats, &sortStats, &emitStats, &writeStats};
+  for (const StageStats *s : stages) {
+    const double busy   = s->busyMicros * 1e-6;
+    const double amount = s->amount * 1e-6;
+    std::cout << "  " << std::left << std::setw(14) << s->name << std::right
+              << std::fixed << std::setprecision(2) << std::setw(9) << busy
+              << " s busy  " << std::setw(10)
+              << (busy > 0.0 ? amount / busy : 0.0) << " " << s->unit
+              << "/s\n";
+  }
+  std::cout.unsetf(std::ios_base::floatfield);
+  std::cout << std::setprecision(6);
+}
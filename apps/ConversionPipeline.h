@@ -0,0 +1,71 @@
+// ======================================================================== //
+// Copyright SCI Institute, University of Utah, 2018
+// ======================================================================== //
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../ospray/VoxelOctree.h"
+#include "dataImporter.h"
+
+/*! Direct conversion of one exajet field as a TBB flow graph (--pipelined).
+ *
+ * The input is read in chunks that flow through
+ *
+ *   read -> key -> (in order) write .vxl
+ *
+ * so reading, Morton keying and the voxel file overlap. Sorting all keys is
+ * the one barrier. The subtrees of the root children are then emitted in
+ * parallel and written to the .octbin in order while later ones are still
+ * being built:
+ *
+ *   emit -> (in order) write .octbin
+ *
+ * The file holds the same nodes as VoxelOctree::saveOctree() of the direct
+ * build, but the tree is never held in memory as a whole. The busy time and
+ * throughput of every stage is reported at the end.
+ */
+class ConversionPipeline
+{
+ public:
+  ConversionPipeline(exajetSource &source, OctreeSubtreeStore *subtreeStore);
+  ~ConversionPipeline();
+
+  /*! convert the field the source was created with into <voxelFile>.vxl
+   * and <octreeFile>.oct/.octbin, and fill in the source metadata */
+  void run(const std::string &voxelFile, const std::string &octreeFile);
+
+ private:
+  struct Chunk;
+  struct Subtree;
+
+  //! busy time and amount of work of one stage, updated by its tasks
+  struct StageStats
+  {
+    std::string name;
+    std::string unit;
+    std::atomic<int64_t> busyMicros{0};
+    std::atomic<size_t> amount{0};
+  };
+
+  void ingest(const std::string &voxelFile);
+  void sortCells();
+  void emit(const std::string &octreeFile);
+  void report(double wallTime);
+
+  exajetSource &source;
+  OctreeSubtreeStore *subtreeStore;
+
+  int hexFd;
+  int fieldFd;
+  size_t numHexes;
+
+  std::vector<MortonCell> cells;
+  int rootLevel;
+
+  StageStats readStats, keyStats, voxelStats, sortStats, emitStats, writeStats;
+};
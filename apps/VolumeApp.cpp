@@ -0,0 +1,94 @@
+#include "VolumeApp.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+
+#include "ospray/common/OSPCommon.h"
+#include "../ospray/VoxelOctree.h"
+#include "dataImporter.h"
+#include "Utils.h"
+
+void parseVolumeAppCommandLine(int &ac,
+                               const char **&av,
+                               VolumeAppOptions &options)
+{
+  for (int i = 1; i < ac; ++i) {
+    const std::string arg = av[i];
+    if (arg == "-t" || arg == "--type") {
+      options.dataType = av[i + 1];
+      removeArgs(ac, av, i, 2);
+      --i;
+    } else if (arg == "-i" || arg == "--input-oct") {
+      options.octFile = FileName(av[i + 1]);
+      removeArgs(ac, av, i, 2);
+      --i;
+    } else if (arg == "-f" || arg == "--field") {
+      options.field = av[i + 1];
+      removeArgs(ac, av, i, 2);
+      --i;
+    } else if (arg == "-m" || arg == "--method") {
+      options.filterMethod = av[i + 1];
+      removeArgs(ac, av, i, 2);
+      --i;
+    } else if (arg == "-n" || arg == "--points") {
+      options.numPoints = std::atoi(av[i + 1]);
+      removeArgs(ac, av, i, 2);
+      --i;
+    } else {
+      throw std::runtime_error("unknown argument: " + arg);
+    }
+  }
+}
+
+OSPVolume newTAMRVolume(const VolumeAppOptions &options)
+{
+  std::shared_ptr<DataSource> pData;
+  if (options.dataType == "synthetic") {
+    pData = std::make_shared<syntheticSource>();
+  } else if (options.dataType == "exajet" || options.dataType == "landing") {
+    pData = std::make_shared<exajetSource>(options.octFile, options.field);
+  } else {
+    throw std::runtime_error("unsupported data type: " + options.dataType);
+  }
+  pData->mapMetaData(options.octFile.str());
+
+  char octreeFileName[10000] = {0};
+  sprintf(octreeFileName,
+          "%s-%s%06i.oct",
+          options.octFile.c_str(),
+          options.field.c_str(),
+          0);
+  VoxelOctree *voxelAccel = new VoxelOctree();
+  voxelAccel->mapOctreeFromFile(octreeFileName);
+  std::cout << yellow << "Loaded " << voxelAccel->_octreeNodes.size()
+            << " octree nodes from '" << octreeFileName << "'" << reset
+            << "\n";
+
+  OSPVolume volume = ospNewVolume("tamr");
+  ospSetVec3f(volume,
+              "worldOrigin",
+              pData->worldOrigin.x,
+              pData->worldOrigin.y,
+              pData->worldOrigin.z);
+  ospSetVec3f(volume,
+              "gridOrigin",
+              pData->gridOrigin.x,
+              pData->gridOrigin.y,
+              pData->gridOrigin.z);
+  ospSetVec3f(volume,
+              "gridWorldSpace",
+              pData->gridWorldSpace.x,
+              pData->gridWorldSpace.y,
+              pData->gridWorldSpace.z);
+  ospSetVec3i(volume,
+              "dimensions",
+              pData->dimensions.x,
+              pData->dimensions.y,
+              pData->dimensions.z);
+  ospSetVoidPtr(volume, "voxelOctree", (void *)voxelAccel);
+  ospSetString(volume, "amrMethod", options.filterMethod.c_str());
+  ospCommit(volume);
+  return volume;
+}
@@ -0,0 +1,31 @@
+// ======================================================================== //
+// Copyright SCI Institute, University of Utah, 2018
+// ======================================================================== //
+
+#pragma once
+
+#include <string>
+
+#include "ospcommon/os/FileName.h"
+#include "ospray/ospray.h"
+
+//! command line of the apps that run one tamr volume without rendering,
+//! tamrBenchmark and tamrFilterCheck
+struct VolumeAppOptions
+{
+  std::string dataType;
+  ospcommon::FileName octFile;
+  std::string field        = "default";
+  std::string filterMethod = "nearest";
+  int numPoints            = 1 << 20;
+};
+
+//! -t, -i and -f as in the viewer, -m <method> and -n <points>
+void parseVolumeAppCommandLine(int &ac,
+                               const char **&av,
+                               VolumeAppOptions &options);
+
+/*! map the octree of the options and commit a "tamr" volume on it, with the
+ * grid of the data set's metadata. The volume deletes the octree when it is
+ * released. */
+OSPVolume newTAMRVolume(const VolumeAppOptions &options);
@@ -1,9 +1,13 @@
 #include "dataImporter.h"
+#include <algorithm>
 #include <fstream>
+#include <sstream>
 #include <vector>
 #include "Utils.h"
 #include "ospcommon/xml/XML.h"
-
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_reduce.h"
+#include "tbb/parallel_sort.h"
 
 void DataSource::saveMetaData(const std::string &fileName)
 {
@@ -17,11 +21,22 @@ void DataSource::saveMetaData(const std::string &fileName)
       fprintf(meta,"    gridOrigin=\"%f %f %f\"\n", gridOrigin.x, gridOrigin.y, gridOrigin.z);
       fprintf(meta,"    gridWorldSpace=\"%f %f %f\"\n", gridWorldSpace.x, gridWorldSpace.y, gridWorldSpace.z);
       fprintf(meta,"    worldOrigin=\"%f %f %f\"\n", worldOrigin.x, worldOrigin.y, worldOrigin.z);
-      fprintf(meta,"    voxelNum=\"%zu\"\n", this->voxels.size());
+      // the direct conversion never fills 'voxels'
+      fprintf(meta,"    voxelNum=\"%zu\"\n",
+              this->voxels.empty() ? voxelNum : this->voxels.size());
+      fprintf(meta,"    voxelRange=\"%f %f\"\n", voxelRange.lower, voxelRange.upper);
       fprintf(meta,"    >\n");
     }
     fprintf(meta, "  </Metadata>\n");
   }
+  for (const auto &f : fieldRanges) {
+    fprintf(meta,
+            "  <Field name=\"%s\" voxelRange=\"%f %f\">\n",
+            f.first.c_str(),
+            f.second.lower,
+            f.second.upper);
+    fprintf(meta, "  </Field>\n");
+  }
   fprintf(meta, "</ospray>\n");
   fclose(meta);
 }
@@ -50,6 +65,20 @@ void DataSource::mapMetaData(const std::string &fileName)
         &worldOrigin.x, &worldOrigin.y, &worldOrigin.z);
 
   sscanf(metaDataNode->getProp("voxelNum").c_str(), "%zu", &voxelNum);
+
+  // older metadata files do not carry the value range
+  if (metaDataNode->getProp("voxelRange") != "")
+    sscanf(metaDataNode->getProp("voxelRange").c_str(), "%f %f",
+           &voxelRange.lower, &voxelRange.upper);
+
+  fieldRanges.clear();
+  for (const xml::Node &node : osprayNode->child) {
+    if (node.name != "Field")
+      continue;
+    range1f range;
+    sscanf(node.getProp("voxelRange").c_str(), "%f %f", &range.lower, &range.upper);
+    fieldRanges[node.getProp("name")] = range;
+  }
 }
 
 void DataSource::saveVoxelsArrayData(const std::string &fileName)
@@ -62,7 +91,7 @@ void DataSource::saveVoxelsArrayData(const std::string &fileName)
   fclose(voxelsFile);
 }
 
-void DataSource::mapVoxelsArrayData(const std::string &fileName)
+void DataSource::readVoxelsArrayData(const std::string &fileName)
 {
   std::string voxelFileName = fileName + ".vxl";
   FILE *file                = fopen(voxelFileName.c_str(), "rb");
@@ -74,71 +103,152 @@ void DataSource::mapVoxelsArrayData(const std::string &fileName)
   fclose(file);
 }
 
+void DataSource::mapVoxelsArrayData(const std::string &fileName)
+{
+  unmapVoxelsArrayData();
+
+  std::string voxelFileName = fileName + ".vxl";
+  int fd                    = open(voxelFileName.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("could not open voxel bin file " + voxelFileName);
+
+  struct stat statBuf = {0};
+  fstat(fd, &statBuf);
+  if (size_t(statBuf.st_size) < voxelNum * sizeof(voxel)) {
+    close(fd);
+    throw std::runtime_error("voxel bin file " + voxelFileName +
+                             " is smaller than its metadata claims");
+  }
+
+  void *mapping = mmap(NULL, statBuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+    throw std::runtime_error("could not map voxel bin file " + voxelFileName);
+
+  // every cell is touched once by the parallel isosurface build, start
+  // faulting the pages in right away
+  madvise(mapping, statBuf.st_size, MADV_WILLNEED);
+
+  mappedVoxels     = static_cast<const voxel *>(mapping);
+  mappedVoxelBytes = statBuf.st_size;
+}
+
+void DataSource::unmapVoxelsArrayData()
+{
+  if (mappedVoxels)
+    munmap((void *)mappedVoxels, mappedVoxelBytes);
+  mappedVoxels     = nullptr;
+  mappedVoxelBytes = 0;
+}
+
+DataSource::~DataSource()
+{
+  unmapVoxelsArrayData();
+}
+
+void DataSource::loadField(const std::string &fieldName)
+{
+  throw std::runtime_error("data source has no field named " + fieldName);
+}
+
 void DataSource::dumpUnstructured(const std::string &fileName){
-  std::vector<vec3f> verts;
-  std::vector<vec4i> indices;
-  std::vector<float> fieldData;
-
-  // FIXME: Using naive indexing for now... for a fair comparison we would need
-  // to implement non-naive indexing, possibly using hash tables - this would
-  // work much like an OBJ writer.
-
-  // Iterate through cells (Feng calls these "voxels")
-  // Each cell has a lower corner, width, and value
-  for (voxel& cell : voxels) {
-    float oct_len = cell.width;
-    float x = cell.lower.x;
-    float y = cell.lower.y;
-    float z = cell.lower.z;
-
-    std::vector<uint32_t> lower_idxs; //indices 0 thru 3 for the current hex
-    std::vector<uint32_t> upper_idxs; //indices 4 thru 7 for the current hex
-
-    // Following the "winding order" found in Hexahedron.cxx from:
-    // https://vtk.org/Wiki/VTK/Examples/Cxx/GeometricObjects/Hexahedron
-    // Because the OSPRay docs say that "for hexahedral cells... vertex ordering
-    // is the same as VTK_HEXAHEDRON: four bottom vertices counterclockwise, then
-    // top four counterclockwise."
-
-    //Vertex 0
-    lower_idxs.push_back(verts.size());
-    verts.push_back(vec3f(x, y, z));
-
-    //Vertex 1
-    lower_idxs.push_back(verts.size());
-    verts.push_back(vec3f(x + oct_len, y, z));
-
-    //Vertex 2
-    lower_idxs.push_back(verts.size());
-    verts.push_back(vec3f(x + oct_len, y + oct_len, z));
-
-    //Vertex 3
-    lower_idxs.push_back(verts.size());
-    verts.push_back(vec3f(x, y + oct_len, z));
-
-    //Vertex 4
-    upper_idxs.push_back(verts.size());
-    verts.push_back(vec3f(x, y, z + oct_len));
-
-    //Vertex 5
-    upper_idxs.push_back(verts.size());
-    verts.push_back(vec3f(x + oct_len, y, z + oct_len));
-
-    //Vertex 6
-    upper_idxs.push_back(verts.size());
-    verts.push_back(vec3f(x + oct_len, y + oct_len, z + oct_len));
-
-    //Vertex 7
-    upper_idxs.push_back(verts.size());
-    verts.push_back(vec3f(x, y + oct_len, z + oct_len));
-
-    //Push indices to the index buffer
-    indices.push_back(vec4i(lower_idxs[0],lower_idxs[1],lower_idxs[2],lower_idxs[3]));
-    indices.push_back(vec4i(upper_idxs[0],upper_idxs[1],upper_idxs[2],upper_idxs[3]));
-
-    fieldData.push_back(cell.value); //Assuming data is cell-centered
+  // Following the "winding order" found in Hexahedron.cxx from:
+  // https://vtk.org/Wiki/VTK/Examples/Cxx/GeometricObjects/Hexahedron
+  // Because the OSPRay docs say that "for hexahedral cells... vertex ordering
+  // is the same as VTK_HEXAHEDRON: four bottom vertices counterclockwise, then
+  // top four counterclockwise."
+  static const vec3i hexCorner[8] = {vec3i(0, 0, 0),
+                                     vec3i(1, 0, 0),
+                                     vec3i(1, 1, 0),
+                                     vec3i(0, 1, 0),
+                                     vec3i(0, 0, 1),
+                                     vec3i(1, 0, 1),
+                                     vec3i(1, 1, 1),
+                                     vec3i(0, 1, 1)};
+
+  const size_t numCells = voxels.size();
+  const float spacing   = gridWorldSpace.x;
+  time_point t1         = Time();
+
+  auto gridLowerOf = [&](const voxel &cell) {
+    return (cell.lower - worldOrigin) / spacing;
+  };
+
+  // the keys are built from the quantized cell corners, not from
+  // 'dimensions': cells offset from worldOrigin or a spacing other than the
+  // one the dimensions were computed with move them out of the key range
+  typedef std::pair<vec3f, vec3f> CornerExtent;
+  const float inf = std::numeric_limits<float>::infinity();
+  const CornerExtent extent = tbb::parallel_reduce(
+      tbb::blocked_range<size_t>(0, numCells, 1 << 16),
+      CornerExtent(vec3f(inf), vec3f(-inf)),
+      [&](const tbb::blocked_range<size_t> &r, CornerExtent partial) {
+        for (size_t i = r.begin(); i < r.end(); ++i) {
+          const vec3f lower = gridLowerOf(voxels[i]);
+          partial.first     = min(partial.first, lower);
+          partial.second =
+              max(partial.second, lower + vec3f(voxels[i].width / spacing));
+        }
+        return partial;
+      },
+      [](const CornerExtent &a, const CornerExtent &b) {
+        return CornerExtent(min(a.first, b.first), max(a.second, b.second));
+      });
+
+  // corners round to the nearest grid point
+  if (numCells > 0 && (reduce_min(extent.first) < -0.5f ||
+                       reduce_max(extent.second) >= (1 << 21) - 0.5f)) {
+    std::stringstream msg;
+    msg << "cell corners span " << extent.first << " to " << extent.second
+        << " grid units, which does not fit into 21 bit Morton keys, cannot "
+           "dump unstructured";
+    throw std::runtime_error(msg.str());
   }
 
+  // Cell corners are snapped to the finest grid, so neighbouring cells share
+  // the exact same integer corner and thereby the same Morton key. The keys
+  // are cheap to recompute, so only the sorted set of them is kept around.
+  auto cornerKey = [&](size_t i, int c) {
+    const voxel &cell = voxels[i];
+    vec3f gridLower   = gridLowerOf(cell);
+    vec3i lower(roundf(gridLower.x), roundf(gridLower.y), roundf(gridLower.z));
+    int width = roundf(cell.width / spacing);
+    return mortonKey(lower + width * hexCorner[c]);
+  };
+
+  std::vector<uint64_t> vertKeys(8 * numCells);
+  tasking::parallel_for(numCells, [&](size_t i) {
+    for (int c = 0; c < 8; c++)
+      vertKeys[8 * i + c] = cornerKey(i, c);
+  });
+  tbb::parallel_sort(vertKeys.begin(), vertKeys.end());
+  vertKeys.erase(std::unique(vertKeys.begin(), vertKeys.end()), vertKeys.end());
+  vertKeys.shrink_to_fit();
+
+  std::vector<vec3f> verts(vertKeys.size());
+  tasking::parallel_for(vertKeys.size(), [&](size_t v) {
+    verts[v] = vec3f(mortonDecode(vertKeys[v])) * spacing + worldOrigin;
+  });
+
+  // two vec4i per hex: the bottom and the top four vertices
+  std::vector<vec4i> indices(2 * numCells);
+  std::vector<float> fieldData(numCells);
+  tasking::parallel_for(numCells, [&](size_t i) {
+    int idx[8];
+    for (int c = 0; c < 8; c++) {
+      idx[c] = std::lower_bound(
+                   vertKeys.begin(), vertKeys.end(), cornerKey(i, c)) -
+               vertKeys.begin();
+    }
+    indices[2 * i]     = vec4i(idx[0], idx[1], idx[2], idx[3]);
+    indices[2 * i + 1] = vec4i(idx[4], idx[5], idx[6], idx[7]);
+    fieldData[i]       = voxels[i].value;  // Assuming data is cell-centered
+  });
+
+  std::cout << "Deduplicated " << 8 * numCells << " hex corners into "
+            << verts.size() << " vertices in " << Time(t1) << " s"
+            << std::endl;
+
   std::cout << "Seralizing: " << fileName << std::endl;
 
   /*
@@ -192,10 +302,27 @@ exajetSource::exajetSource(const FileName filePath,
   this->exaJetWorldOrigin = worldOrigin;
 }
 
+//! partial result of the parallel hexahedron parse
+struct HexParseReduction
+{
+  float minWidth = std::numeric_limits<float>::max();
+  box3f bounds   = box3f(vec3f(0.0f));
+  range1f vRange;
+
+  void join(const HexParseReduction &other)
+  {
+    minWidth = std::min(minWidth, other.minWidth);
+    bounds.extend(other.bounds);
+    vRange.extend(other.vRange);
+  }
+};
+
 void exajetSource::parseData()
 {
    // Open the hexahedron data file
-  int hexFd           = open(filePath.c_str(), O_RDONLY);
+  int hexFd = open(filePath.c_str(), O_RDONLY);
+  if (hexFd < 0)
+    throw std::runtime_error("could not open hexahedron file " + filePath.str());
   struct stat statBuf = {0};
   fstat(hexFd, &statBuf);
   size_t numHexes = statBuf.st_size / sizeof(Hexahedron);
@@ -205,27 +332,41 @@ void exajetSource::parseData()
 
   void *hexMapping =
       mmap(NULL, statBuf.st_size, PROT_READ, MAP_PRIVATE, hexFd, 0);
+  close(hexFd);
   if (hexMapping == MAP_FAILED) {
-    std::cout << "Failed to map hexes file\n";
     perror("hex_mapping file");
-    return;
+    throw std::runtime_error("could not map hexahedron file " + filePath.str());
   }
+  madvise(hexMapping, statBuf.st_size, MADV_SEQUENTIAL);
 
   // Open the field data file
   //   const std::string cellFieldName = "y_vorticity.bin";
   const FileName fieldFile = filePath.path() + fieldName;
   // std::cout << "Loading field file: " << fieldFile << "\n";
-  int fieldFd              = open(fieldFile.c_str(), O_RDONLY);
+  int fieldFd = open(fieldFile.c_str(), O_RDONLY);
+  if (fieldFd < 0) {
+    munmap(hexMapping, statBuf.st_size);
+    throw std::runtime_error("could not open field file " + fieldFile.str());
+  }
   struct stat fieldStatBuf = {0};
   fstat(fieldFd, &fieldStatBuf);
   // std::cout "\033["<< "File " << fieldFile.c_str() << "\n"
   //           << "size: " << fieldStatBuf.st_size <<"m" <<"\n";
   void *fieldMapping =
       mmap(NULL, fieldStatBuf.st_size, PROT_READ, MAP_PRIVATE, fieldFd, 0);
+  close(fieldFd);
   if (fieldMapping == MAP_FAILED) {
-    std::cout << "Failed to map field file\n";
     perror("field_mapping file");
-    return;
+    munmap(hexMapping, statBuf.st_size);
+    throw std::runtime_error("could not map field file " + fieldFile.str());
+  }
+  madvise(fieldMapping, fieldStatBuf.st_size, MADV_SEQUENTIAL);
+
+  if (size_t(fieldStatBuf.st_size) / sizeof(float) < numHexes) {
+    munmap(hexMapping, statBuf.st_size);
+    munmap(fieldMapping, fieldStatBuf.st_size);
+    throw std::runtime_error("field " + fieldName +
+                             " has fewer values than there are hexahedra");
   }
 
   size_t sIdx = 0;
@@ -239,23 +380,39 @@ void exajetSource::parseData()
 
   this->voxels.resize(showHexsNum);
 
-  float minWidth = std::numeric_limits<float>::max();
-  box3f bounds(vec3f(0.0f));
+  // chunks are large enough that each task streams through whole pages of
+  // both mappings, the partial extents are merged pairwise
+  const size_t grainSize = 1 << 16;
+  HexParseReduction result = tbb::parallel_reduce(
+      tbb::blocked_range<size_t>(sIdx, eIdx, grainSize),
+      HexParseReduction(),
+      [&](const tbb::blocked_range<size_t> &r, HexParseReduction partial) {
+        for (size_t i = r.begin(); i < r.end(); ++i) {
+          const Hexahedron &h = hexes[i];
+          if (desiredLevel == -1 || h.level == desiredLevel) {
+            vec3f lower = vec3f(h.lower - exaJetGridMin) * exaJetVoxelScale +
+                          exaJetWorldOrigin;
+            float width = (1 << h.level) * exaJetVoxelScale;
+            if (width < partial.minWidth)
+              partial.minWidth = width;
+            partial.bounds.extend(lower + vec3f(width));
+            partial.vRange.extend(cellField[i]);
+            this->voxels[i - sIdx] = voxel(lower, width, cellField[i]);
+          }
+        }
+        return partial;
+      },
+      [](HexParseReduction a, const HexParseReduction &b) {
+        a.join(b);
+        return a;
+      });
 
-  range1f vRange;
+  munmap(hexMapping, statBuf.st_size);
+  munmap(fieldMapping, fieldStatBuf.st_size);
 
-  for (size_t i = sIdx; i < eIdx; ++i) {
-    const Hexahedron &h = hexes[i];
-    if (desiredLevel == -1 || h.level == desiredLevel) {
-      vec3f lower = vec3f(h.lower - exaJetGridMin) * exaJetVoxelScale + exaJetWorldOrigin;
-      float width = (1 << h.level) * exaJetVoxelScale;
-      if(width < minWidth)
-        minWidth = width;
-      bounds.extend(lower + vec3f(width));
-      vRange.extend(cellField[i]);
-      this->voxels[i-sIdx] = voxel(lower,width,cellField[i]);
-    }
-  }
+  const float minWidth = result.minWidth;
+  const box3f bounds   = result.bounds;
+  const range1f vRange = result.vRange;
 
   PRINT(vRange);
 
@@ -267,6 +424,227 @@ void exajetSource::parseData()
   this->voxelRange     = vRange;
 }
 
+void exajetSource::loadField(const std::string &fieldName)
+{
+  // the field files store one float per hexahedron in the same order as the
+  // hexes file, so only the values of the parsed voxels change
+  const FileName fieldFile = filePath.path() + fieldName;
+  int fieldFd              = open(fieldFile.c_str(), O_RDONLY);
+  if (fieldFd < 0)
+    throw std::runtime_error("could not open field file " + fieldFile.str());
+  struct stat fieldStatBuf = {0};
+  fstat(fieldFd, &fieldStatBuf);
+
+  const size_t numValues = fieldStatBuf.st_size / sizeof(float);
+  if (numValues != voxels.size()) {
+    close(fieldFd);
+    throw std::runtime_error("field " + fieldName +
+                             " does not match the number of hexahedra");
+  }
+
+  void *fieldMapping =
+      mmap(NULL, fieldStatBuf.st_size, PROT_READ, MAP_PRIVATE, fieldFd, 0);
+  close(fieldFd);
+  if (fieldMapping == MAP_FAILED)
+    throw std::runtime_error("could not map field file " + fieldFile.str());
+  madvise(fieldMapping, fieldStatBuf.st_size, MADV_SEQUENTIAL);
+
+  std::cout << yellow << "Loading Field: " << fieldName << reset << "\n";
+
+  const float *cellField = static_cast<const float *>(fieldMapping);
+  const size_t blockSize = 1 << 20;
+  const size_t numBlocks = (numValues + blockSize - 1) / blockSize;
+  std::vector<range1f> blockRange(numBlocks);
+
+  tasking::parallel_for(numBlocks, [&](size_t b) {
+    size_t end = std::min(numValues, (b + 1) * blockSize);
+    for (size_t i = b * blockSize; i < end; i++) {
+      voxels[i].value = cellField[i];
+      blockRange[b].extend(cellField[i]);
+    }
+  });
+
+  range1f vRange;
+  for (const range1f &r : blockRange)
+    vRange.extend(r);
+  PRINT(vRange);
+
+  munmap(fieldMapping, fieldStatBuf.st_size);
+  this->fieldName  = fieldName;
+  this->voxelRange = vRange;
+}
+
+//! read-only mapping of a whole file, released with the object
+struct FileMapping
+{
+  FileMapping(const std::string &fileName, int advice)
+  {
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::runtime_error("could not open " + fileName);
+    struct stat statBuf = {0};
+    fstat(fd, &statBuf);
+    bytes = statBuf.st_size;
+    data  = mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+      throw std::runtime_error("could not map " + fileName);
+    madvise(data, bytes, advice);
+  }
+
+  ~FileMapping()
+  {
+    munmap(data, bytes);
+  }
+
+  void *data;
+  size_t bytes;
+};
+
+//! integer extent, finest level and value range of the hexahedra
+struct HexGridReduction
+{
+  int minLevel  = std::numeric_limits<int>::max();
+  vec3i lower   = vec3i(std::numeric_limits<int>::max());
+  vec3i upper   = vec3i(std::numeric_limits<int>::min());
+  range1f vRange;
+
+  void join(const HexGridReduction &other)
+  {
+    minLevel = std::min(minLevel, other.minLevel);
+    lower    = min(lower, other.lower);
+    upper    = max(upper, other.upper);
+    vRange.extend(other.vRange);
+  }
+};
+
+std::shared_ptr<VoxelOctree> exajetSource::buildOctree(
+    OctreeSubtreeStore *subtreeStore)
+{
+  FileMapping hexFile(filePath.str(), MADV_SEQUENTIAL);
+  FileMapping fieldFile(filePath.path() + fieldName, MADV_SEQUENTIAL);
+
+  const size_t numHexes = hexFile.bytes / sizeof(Hexahedron);
+  std::cout << yellow << "Loading File: " << filePath.base() << "\t"
+            << "Field: " << fieldName << "\t"
+            << "#Voxels: " << numHexes << reset << "\n";
+  if (fieldFile.bytes / sizeof(float) < numHexes)
+    throw std::runtime_error("field " + fieldName +
+                             " has fewer values than there are hexahedra");
+
+  const Hexahedron *hexes = static_cast<const Hexahedron *>(hexFile.data);
+  const float *cellField  = static_cast<const float *>(fieldFile.data);
+
+  HexGridReduction grid = tbb::parallel_reduce(
+      tbb::blocked_range<size_t>(0, numHexes, 1 << 16),
+      HexGridReduction(),
+      [&](const tbb::blocked_range<size_t> &r, HexGridReduction partial) {
+        for (size_t i = r.begin(); i < r.end(); ++i) {
+          const Hexahedron &h = hexes[i];
+          const vec3i lower   = h.lower - exaJetGridMin;
+          partial.minLevel    = std::min(partial.minLevel, h.level);
+          partial.lower       = min(partial.lower, lower);
+          partial.upper       = max(partial.upper, lower + vec3i(1 << h.level));
+          partial.vRange.extend(cellField[i]);
+        }
+        return partial;
+      },
+      [](HexGridReduction a, const HexGridReduction &b) {
+        a.join(b);
+        return a;
+      });
+
+  if (grid.lower.x < 0 || grid.lower.y < 0 || grid.lower.z < 0)
+    throw std::runtime_error("hexahedra below the grid minimum of " +
+                             filePath.str());
+
+  minLevel = grid.minLevel;
+  PRINT(minLevel);
+  PRINT(grid.vRange);
+
+  this->dimensions     = vec3i(grid.upper.x >> minLevel,
+                           grid.upper.y >> minLevel,
+                           grid.upper.z >> minLevel);
+  this->gridOrigin     = vec3f(0.f);
+  this->gridWorldSpace = vec3f((1 << minLevel) * exaJetVoxelScale);
+  this->worldOrigin    = exaJetWorldOrigin;
+  this->voxelRange     = grid.vRange;
+  this->voxelNum       = numHexes;
+
+  return std::make_shared<VoxelOctree>(hexes,
+                                       cellField,
+                                       numHexes,
+                                       exaJetGridMin,
+                                       minLevel,
+                                       box3f(gridOrigin, vec3f(dimensions)),
+                                       gridWorldSpace,
+                                       worldOrigin,
+                                       subtreeStore);
+}
+
+void exajetSource::mapOctreeMetaData(const std::string &fileName)
+{
+  mapMetaData(fileName);
+  // buildOctree() sets gridWorldSpace to (1 << minLevel) * exaJetVoxelScale
+  minLevel = int(std::round(std::log2(gridWorldSpace.x / exaJetVoxelScale)));
+}
+
+void exajetSource::loadFieldIntoOctree(const std::string &fieldName,
+                                       VoxelOctree &tree)
+{
+  FileMapping hexFile(filePath.str(), MADV_SEQUENTIAL);
+  FileMapping fieldFile(filePath.path() + fieldName, MADV_SEQUENTIAL);
+
+  const size_t numHexes = hexFile.bytes / sizeof(Hexahedron);
+  if (fieldFile.bytes / sizeof(float) != numHexes)
+    throw std::runtime_error("field " + fieldName +
+                             " does not match the number of hexahedra");
+
+  std::cout << yellow << "Loading Field: " << fieldName << reset << "\n";
+  tree.updateLeafValues(static_cast<const Hexahedron *>(hexFile.data),
+                        static_cast<const float *>(fieldFile.data),
+                        numHexes,
+                        exaJetGridMin,
+                        minLevel);
+}
+
+void exajetSource::writeVoxelsArrayData(const std::string &fileName,
+                                        const std::string &fieldName)
+{
+  FileMapping hexFile(filePath.str(), MADV_SEQUENTIAL);
+  FileMapping fieldFile(filePath.path() + fieldName, MADV_SEQUENTIAL);
+
+  const size_t numHexes   = hexFile.bytes / sizeof(Hexahedron);
+  const Hexahedron *hexes = static_cast<const Hexahedron *>(hexFile.data);
+  const float *cellField  = static_cast<const float *>(fieldFile.data);
+  if (fieldFile.bytes / sizeof(float) < numHexes)
+    throw std::runtime_error("field " + fieldName +
+                             " has fewer values than there are hexahedra");
+
+  const std::string voxlBinFile = fileName + ".vxl";
+  FILE *voxelsFile              = fopen(voxlBinFile.c_str(), "wb");
+  if (!voxelsFile)
+    throw std::runtime_error("Could not write" + voxlBinFile);
+
+  // same world space voxels as parseData(), but only one chunk in memory
+  const size_t chunkSize = 1 << 20;
+  std::vector<voxel> chunk(std::min(chunkSize, numHexes));
+  for (size_t begin = 0; begin < numHexes; begin += chunkSize) {
+    const size_t n = std::min(chunkSize, numHexes - begin);
+    tasking::parallel_for(n, [&](size_t i) {
+      const Hexahedron &h = hexes[begin + i];
+      vec3f lower = vec3f(h.lower - exaJetGridMin) * exaJetVoxelScale +
+                    exaJetWorldOrigin;
+      float width = (1 << h.level) * exaJetVoxelScale;
+      chunk[i]    = voxel(lower, width, cellField[begin + i]);
+    });
+    if (fwrite(chunk.data(), sizeof(voxel), n, voxelsFile) != n) {
+      fclose(voxelsFile);
+      throw std::runtime_error("Could not write" + voxlBinFile);
+    }
+  }
+  fclose(voxelsFile);
+}
 
 void syntheticSource::parseData()
 {
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -8,6 +10,7 @@
 #include <fstream>
 #include <iostream>
 #include <limits>
+#include <map>
 #include <vector>
 
 #include "../ospray/VoxelOctree.h"
@@ -21,19 +24,24 @@ using namespace ospcommon;
 using namespace ospcommon::math;
 using namespace std;
 
-struct Hexahedron
-{
-  vec3i lower;
-  int level;
-};
+//! the hexahedron files store integer cells, see OctreeCell
+typedef OctreeCell Hexahedron;
 
 struct DataSource{
 public:
+  virtual ~DataSource();
+
   std::vector<voxel> voxels;
 
-  size_t voxelNum;
+  //! read-only view of a .vxl file, set by mapVoxelsArrayData()
+  const voxel *mappedVoxels = nullptr;
+
+  size_t voxelNum = 0;
 
   range1f voxelRange;
+  //! value range of every converted field by name, voxelRange is the one of
+  //! the field the topology was built from
+  std::map<std::string, range1f> fieldRanges;
 
   //! Volume size in voxels per dimension. e.g. (4 x 4 x 2)
   vec3i dimensions;
@@ -44,12 +52,21 @@ public:
   vec3f worldOrigin;
 
   virtual void parseData() =0;
+  //! replace the voxel values with another field defined on the same cells
+  virtual void loadField(const std::string &fieldName);
 
   void saveMetaData(const std::string &fileName);
   void saveVoxelsArrayData(const std::string &fileName);
   void mapMetaData(const std::string &fileName);
+  //! copy the .vxl file into 'voxels', for callers that modify the values
+  void readVoxelsArrayData(const std::string &fileName);
+  //! mmap the .vxl file into 'mappedVoxels' without copying it
   void mapVoxelsArrayData(const std::string &fileName);
+  void unmapVoxelsArrayData();
   void dumpUnstructured(const std::string &fileName);
+
+ private:
+  size_t mappedVoxelBytes = 0;
 };
 
 
@@ -66,14 +83,33 @@ struct exajetSource: public DataSource{
                float voxelScale,
                vec3f worldOrigin);
   void parseData() override;
+  void loadField(const std::string &fieldName) override;
+
+  /*! direct conversion: build the octree of the current field from the
+   * mmapped hexahedra and field file with integer keys. 'voxels' stays
+   * empty, the metadata is filled in like parseData() does. */
+  std::shared_ptr<VoxelOctree> buildOctree(OctreeSubtreeStore *subtreeStore);
+  //! mapMetaData() of a finished buildOctree() run, also restores the finest
+  //! level the tree was built on
+  void mapOctreeMetaData(const std::string &fileName);
+  //! replace the leaf values of a tree from buildOctree() with another field
+  void loadFieldIntoOctree(const std::string &fieldName, VoxelOctree &tree);
+  //! write the .vxl file of a field chunk by chunk from the mapped files
+  void writeVoxelsArrayData(const std::string &fileName,
+                            const std::string &fieldName);
 
  private:
+  //! the pipelined converter reads the files itself
+  friend class ConversionPipeline;
+
   FileName filePath;
   string fieldName;
 
   vec3i exaJetGridMin;
   float exaJetVoxelScale;
   vec3f exaJetWorldOrigin;
+  //! finest level of the hexahedra, set by buildOctree()
+  int minLevel = 0;
 };
 
 
@@ -0,0 +1,85 @@
+#include "unstructuredLoader.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <stdexcept>
+
+UnstructuredLoader::UnstructuredLoader(const std::string &baseName)
+    : vertFile(baseName + ".v.unstruct"),
+      indexFile(baseName + ".i.unstruct"),
+      fieldFile(baseName + ".f.unstruct")
+{
+  numVertices = vertFile.bytes / sizeof(vec3f);
+  numCells    = fieldFile.bytes / sizeof(float);
+
+  // every hexahedron is stored as two vec4i, bottom and top face
+  if (indexFile.bytes / sizeof(vec4i) != 2 * numCells)
+    throw std::runtime_error("index and field files of " + baseName +
+                             " do not describe the same cells");
+
+  std::cout << "Mapped " << numVertices << " vertices and " << numCells
+            << " hexahedra from " << baseName << std::endl;
+
+  cellTypes.assign(numCells, OSP_HEXAHEDRON);
+
+  vertexData = ospNewData(
+      numVertices, OSP_VEC3F, vertFile.ptr, OSP_DATA_SHARED_BUFFER);
+  indexData = ospNewData(
+      2 * numCells, OSP_VEC4I, indexFile.ptr, OSP_DATA_SHARED_BUFFER);
+  cellValueData = ospNewData(
+      numCells, OSP_FLOAT, fieldFile.ptr, OSP_DATA_SHARED_BUFFER);
+  cellTypeData = ospNewData(
+      numCells, OSP_UCHAR, cellTypes.data(), OSP_DATA_SHARED_BUFFER);
+
+  ospCommit(vertexData);
+  ospCommit(indexData);
+  ospCommit(cellValueData);
+  ospCommit(cellTypeData);
+}
+
+UnstructuredLoader::~UnstructuredLoader()
+{
+  ospRelease(vertexData);
+  ospRelease(indexData);
+  ospRelease(cellValueData);
+  ospRelease(cellTypeData);
+}
+
+void UnstructuredLoader::setVolumeData(OSPVolume volume)
+{
+  ospSetData(volume, "vertex.position", vertexData);
+  ospSetData(volume, "cell.value", cellValueData);
+  ospSetData(volume, "index", indexData);
+  ospSetData(volume, "cell.type", cellTypeData);
+}
+
+UnstructuredLoader::MappedFile::MappedFile(const std::string &fileName)
+{
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("Could not open unstructured file: " + fileName);
+
+  struct stat statBuf = {0};
+  fstat(fd, &statBuf);
+
+  bytes = statBuf.st_size;
+  ptr   = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (ptr == MAP_FAILED) {
+    ptr = nullptr;
+    throw std::runtime_error("Could not map unstructured file: " + fileName);
+  }
+
+  // OSPRay builds its BVH over all cells right at commit
+  madvise(ptr, bytes, MADV_WILLNEED);
+}
+
+UnstructuredLoader::MappedFile::~MappedFile()
+{
+  if (ptr)
+    munmap(ptr, bytes);
+}
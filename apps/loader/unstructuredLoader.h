@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "ospcommon/math/vec.h"
+#include "ospray/ospray.h"
+
+using namespace ospcommon;
+using namespace ospcommon::math;
+
+/** \brief zero-copy reader for the '.v.unstruct', '.i.unstruct' and
+ * '.f.unstruct' files written by DataSource::dumpUnstructured.
+ *
+ * The files are mmap'd and wrapped in shared OSPData, nothing is copied on
+ * the application side. The OSPData keep pointing into the mappings, so the
+ * loader has to outlive every volume the arrays are bound to. */
+class UnstructuredLoader
+{
+ public:
+  explicit UnstructuredLoader(const std::string &baseName);
+  ~UnstructuredLoader();
+
+  UnstructuredLoader(const UnstructuredLoader &) = delete;
+  UnstructuredLoader &operator=(const UnstructuredLoader &) = delete;
+
+  //! bind vertex.position, index, cell.value and cell.type to 'volume'
+  void setVolumeData(OSPVolume volume);
+
+  size_t numVertices = 0;
+  size_t numCells    = 0;
+
+ private:
+  //! read-only mapping of a whole file, unmapped with the object, so a
+  //! constructor that throws half way leaves nothing mapped
+  struct MappedFile
+  {
+    explicit MappedFile(const std::string &fileName);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    void *ptr    = nullptr;
+    size_t bytes = 0;
+  };
+
+  MappedFile vertFile;
+  MappedFile indexFile;
+  MappedFile fieldFile;
+  //! OSP_HEXAHEDRON for every cell, the only array not backed by a file
+  std::vector<uint8_t> cellTypes;
+
+  OSPData vertexData    = nullptr;
+  OSPData indexData     = nullptr;
+  OSPData cellValueData = nullptr;
+  OSPData cellTypeData  = nullptr;
+};
@@ -17,11 +17,15 @@
 #include <algorithm>
 #include <fstream>
 #include <iterator>
+#include <limits>
 #include <sstream>
 #include <string>
 #include <vector>
 
+#include "../ospray/TimeSeriesOctree.h"
 #include "../ospray/VoxelOctree.h"
+#include "ConversionCheckpoint.h"
+#include "ConversionPipeline.h"
 #include "dataImporter.h"
 #include "loader/meshloader.h"
 
@@ -43,8 +47,26 @@ void split_string(const std::string &str, Container &cont, char delim = ' ')
 std::string inputDataType;
 FileName inputData;
 FileName inputField("default");
+//! all fields to convert, they share the topology of the first one
+std::vector<FileName> inputFields;
 std::string outputFile;
 bool unstructured = false;
+//! record finished stages in <output>.ckpt, implied by --resume
+bool checkpointing = false;
+bool resume = false;
+//! prefix of an existing conversion to derive a new octree from
+std::string inputOctree;
+bool extractROI = false;
+//! region of interest in world coordinates
+box3f roi;
+//! depth limit of a coarsened preview octree, -1 keeps the full resolution
+int maxDepth = -1;
+//! keyframe interval of a time series over the -f list, 0 disables it
+int timeSeriesKeyframes = 0;
+//! build from the integer hexahedra without materializing the voxels
+bool directBuild = false;
+//! overlap the stages of the direct build in a flow graph
+bool pipelined = false;
 
 void parseCommandLine(int &ac, const char **&av)
 {
@@ -59,7 +81,12 @@ void parseCommandLine(int &ac, const char **&av)
       removeArgs(ac, av, i, 2);
       --i;
     } else if (arg == "-f" || arg == "--field") {
-      inputField = FileName(av[i + 1]);
+      // accepts a comma separated list, e.g. -f density.bin,y_vorticity.bin
+      std::vector<std::string> fields;
+      split_string(av[i + 1], fields, ',');
+      for (const std::string &f : fields)
+        inputFields.push_back(FileName(f));
+      inputField = inputFields[0];
       removeArgs(ac, av, i, 2);
       --i;
     }else if (arg == "-o" || arg == "--output"){
@@ -70,6 +97,44 @@ void parseCommandLine(int &ac, const char **&av)
       unstructured = true;
       removeArgs(ac, av, i, 2);
       --i;
+    } else if (arg == "--checkpoint") {
+      checkpointing = true;
+      removeArgs(ac, av, i, 1);
+      --i;
+    } else if (arg == "--resume") {
+      checkpointing = true;
+      resume        = true;
+      removeArgs(ac, av, i, 1);
+      --i;
+    } else if (arg == "-i" || arg == "--input") {
+      inputOctree = av[i + 1];
+      removeArgs(ac, av, i, 2);
+      --i;
+    } else if (arg == "--direct") {
+      directBuild = true;
+      removeArgs(ac, av, i, 1);
+      --i;
+    } else if (arg == "--pipelined") {
+      directBuild = true;
+      pipelined   = true;
+      removeArgs(ac, av, i, 1);
+      --i;
+    } else if (arg == "--timeseries") {
+      timeSeriesKeyframes = std::atoi(av[i + 1]);
+      removeArgs(ac, av, i, 2);
+      --i;
+    } else if (arg == "--max-depth" || arg == "--coarsen") {
+      maxDepth = std::atoi(av[i + 1]);
+      if (maxDepth < 0)
+        throw runtime_error("--max-depth must be 0 or larger!");
+      removeArgs(ac, av, i, 2);
+      --i;
+    } else if (arg == "--roi") {
+      extractROI = true;
+      roi.lower  = vec3f(std::atof(av[i + 1]), std::atof(av[i + 2]), std::atof(av[i + 3]));
+      roi.upper  = vec3f(std::atof(av[i + 4]), std::atof(av[i + 5]), std::atof(av[i + 6]));
+      removeArgs(ac, av, i, 7);
+      --i;
     } else {
       throw "Invalid argument!";
     }
@@ -80,16 +145,207 @@ void parseCommandLine(int &ac, const char **&av)
   if (inputDataType == "")
     throw runtime_error("Input data type must be set!!");
 
-  if (inputData == "" && inputDataType != "synthetic")
+  if (inputData == "" && inputDataType != "synthetic" && inputOctree == "")
     throw runtime_error("Input file must be set!!");
 
+  if ((extractROI || maxDepth >= 0) && inputOctree == "")
+    throw runtime_error("--roi and --max-depth need an existing octree given by -i!");
+
   if (inputDataType == "exajet" && inputField == "")
     throw runtime_error("Data field must be set for the exajet data!");
 
   if (outputFile == "")
     throw runtime_error("Output data type must be set!!");
+
+  if (directBuild && inputDataType != "exajet" && inputDataType != "landing")
+    throw runtime_error("--direct only supports hexahedron inputs!");
+
+  if (directBuild && (unstructured || timeSeriesKeyframes > 0))
+    throw runtime_error("--direct cannot be combined with -u or --timeseries!");
+
+  if (inputFields.empty())
+    inputFields.push_back(inputField);
+}
+
+std::string voxelFileName(const std::string &prefix, const FileName &field)
+{
+  char fileName[10000];
+  sprintf(fileName, "%s-%s", prefix.c_str(), field.name().c_str());
+  return fileName;
+}
+
+std::string octreeFileName(const std::string &prefix, const FileName &field)
+{
+  char fileName[10000];
+  sprintf(fileName, "%s-%s%06i", prefix.c_str(), field.name().c_str(), 0);
+  return fileName;
+}
+
+// record the value range of a converted field and rewrite the metadata,
+// whose voxelRange is always the one of the first field
+void saveFieldRange(DataSource &data, const FileName &field, const range1f &range)
+{
+  data.fieldRanges[field.name()] = range;
+  data.voxelRange = data.fieldRanges[inputFields[0].name()];
+  data.saveMetaData(outputFile);
+}
+
+// Derive a cropped (--roi) and/or coarsened (--max-depth) copy of every field
+// of the conversion given by -i. Only the overlapping subtrees of the input
+// .octbin files are read.
+int deriveFromOctree(std::shared_ptr<DataSource> pData)
+{
+  pData->mapMetaData(inputOctree);
+  const vec3f worldOrigin = pData->worldOrigin;
+  box3f gridROI;
+  if (extractROI) {
+    gridROI = box3f((roi.lower - worldOrigin) / pData->gridWorldSpace,
+                    (roi.upper - worldOrigin) / pData->gridWorldSpace);
+  } else {
+    // everything, the root always splits this box so the tree is not
+    // re-rooted
+    gridROI = box3f(vec3f(0.f), vec3f(std::numeric_limits<float>::max()));
+  }
+  PRINT(gridROI);
+
+  // the output only holds the fields given by -f
+  pData->fieldRanges.clear();
+
+  std::shared_ptr<VoxelOctree> region;
+  for (size_t f = 0; f < inputFields.size(); f++) {
+    time_point t1 = Time();
+    region        = VoxelOctree::extractRegionFromFile(
+        octreeFileName(inputOctree, inputFields[f]) + ".oct",
+        worldOrigin,
+        gridROI,
+        maxDepth);
+    std::cout << yellow << "Extracting " << inputFields[f].name()
+              << " takes " << Time(t1) << " s" << reset << "\n";
+
+    region->saveOctree(octreeFileName(outputFile, inputFields[f]));
+    pData->fieldRanges[inputFields[f].name()] = region->_octreeNodes[0].vRange;
+    pData->voxels = region->collectLeafVoxels();
+    pData->saveVoxelsArrayData(voxelFileName(outputFile, inputFields[f]));
+  }
+
+  const vec3f upper = region->_actualBounds.upper;
+  pData->dimensions = vec3i(ceil(upper.x), ceil(upper.y), ceil(upper.z));
+  pData->gridOrigin  = vec3f(0.f);
+  pData->worldOrigin = region->_worldOrigin;
+  pData->voxelRange  = pData->fieldRanges[inputFields[0].name()];
+  pData->saveMetaData(outputFile);
+  return 0;
+}
+
+// identifies the inputs of a conversion for ConversionCheckpoint: the type
+// (which fixes the grid), the build mode and every input file with its size
+// and modification time
+std::string inputFingerprint()
+{
+  std::stringstream fingerprint;
+  fingerprint << inputDataType << (directBuild ? " direct" : "")
+              << (pipelined ? " pipelined" : "");
+
+  auto addFile = [&](const std::string &fileName) {
+    struct stat statBuf = {0};
+    stat(fileName.c_str(), &statBuf);
+    fingerprint << "|" << fileName << ":" << statBuf.st_size << ":"
+                << statBuf.st_mtime;
+  };
+  if (inputDataType != "synthetic") {
+    addFile(inputData.str());
+    // the field files sit next to the hexahedra
+    for (const FileName &field : inputFields)
+      addFile(inputData.path() + field.str());
+  }
+  return fingerprint.str();
+}
+
+// the output is complete, a later --resume would have nothing left to skip
+int finishConversion(ConversionCheckpoint *checkpoint)
+{
+  if (checkpoint)
+    checkpoint->remove();
+  return 0;
+}
+
+bool isStageDone(ConversionCheckpoint *checkpoint, const std::string &stage)
+{
+  return checkpoint && checkpoint->isStageDone(stage);
 }
 
+void markStageDone(ConversionCheckpoint *checkpoint,
+                   const std::string &stage,
+                   const std::vector<std::string> &files)
+{
+  if (checkpoint)
+    checkpoint->markStageDone(stage, files);
+}
+
+// --direct: build the octree from the mapped hexahedra and write every field
+// straight from its file, the voxel array is never held in memory.
+// --pipelined converts the first field with ConversionPipeline instead.
+int convertDirect(exajetSource &exajet,
+                  ConversionCheckpoint *checkpoint,
+                  const std::vector<std::string> &voxelFiles,
+                  const std::vector<std::string> &octreeFiles,
+                  const std::vector<bool> &fieldDone)
+{
+  const bool otherFieldsLeft =
+      std::find(fieldDone.begin() + 1, fieldDone.end(), false) != fieldDone.end();
+
+  std::shared_ptr<VoxelOctree> tree;
+  if (fieldDone[0]) {
+    // resumed after the first field: its metadata and octree are final, the
+    // other fields only need the topology
+    exajet.mapOctreeMetaData(outputFile);
+    if (otherFieldsLeft) {
+      tree = std::make_shared<VoxelOctree>();
+      tree->mapOctreeFromFile(octreeFiles[0] + ".oct");
+    }
+  } else if (pipelined) {
+    // the pipeline streams the first field to disk without keeping the tree,
+    // the other fields update a copy read back from its file
+    ConversionPipeline pipeline(exajet, checkpoint);
+    pipeline.run(voxelFiles[0], octreeFiles[0]);
+    saveFieldRange(exajet, inputFields[0], exajet.voxelRange);
+    markStageDone(checkpoint,
+                  "octree-" + inputFields[0].name(),
+                  {octreeFiles[0] + ".oct",
+                   octreeFiles[0] + ".octbin",
+                   voxelFiles[0] + ".vxl"});
+    if (otherFieldsLeft) {
+      tree = std::make_shared<VoxelOctree>();
+      tree->mapOctreeFromFile(octreeFiles[0] + ".oct");
+    }
+  } else {
+    tree = exajet.buildOctree(checkpoint);
+    saveFieldRange(exajet, inputFields[0], exajet.voxelRange);
+  }
+
+  for (size_t f = 0; f < inputFields.size(); f++) {
+    // the pipeline has written the first field already
+    if (fieldDone[f] || (f == 0 && pipelined))
+      continue;
+
+    time_point t1 = Time();
+    if (f > 0) {
+      exajet.loadFieldIntoOctree(inputFields[f].str(), *tree);
+      saveFieldRange(exajet, inputFields[f], tree->_octreeNodes[0].vRange);
+    }
+    exajet.writeVoxelsArrayData(voxelFiles[f], inputFields[f].str());
+    tree->saveOctree(octreeFiles[f]);
+    std::cout << yellow << "Field " << inputFields[f].name() << ": "
+              << Time(t1) << " s" << reset << "\n";
+
+    markStageDone(checkpoint,
+                  "octree-" + inputFields[f].name(),
+                  {octreeFiles[f] + ".oct",
+                   octreeFiles[f] + ".octbin",
+                   voxelFiles[f] + ".vxl"});
+  }
+  return finishConversion(checkpoint);
+}
 
 //only support for one tree currently, need to extend to multiple tree
 int main(int argc, const char **argv)
@@ -131,31 +387,84 @@ int main(int argc, const char **argv)
     pData = std::make_shared<exajetSource>(inputData, inputField.str(),gridMin,voxelScale,worldOrigin);
   }
 
-  if (inputDataType == "synthetic" || inputDataType == "exajet" ||
-      inputDataType == "landing") {
-    time_point t1 = Time();
-    pData->parseData();
-    double loadTime = Time(t1);
-    std::cout << yellow << "Loading time: " << loadTime << " s" << reset
-              << "\n";
-    pData->saveMetaData(outputFile);
+  if (extractROI || maxDepth >= 0)
+    return deriveFromOctree(pData);
+
+  // with --checkpoint completed stages are recorded in <output>.ckpt, a
+  // rerun with --resume validates them and only redoes what is missing or
+  // corrupted. Plain conversions write no checkpoints at all.
+  std::shared_ptr<ConversionCheckpoint> checkpoint;
+  if (checkpointing) {
+    checkpoint = std::make_shared<ConversionCheckpoint>(outputFile, resume);
+    checkpoint->validateInput(inputFingerprint());
+  }
+
+  std::vector<std::string> voxelFiles, octreeFiles;
+  std::vector<bool> fieldDone;
+  bool allFieldsDone = true;
+  for (const FileName &field : inputFields) {
+    voxelFiles.push_back(voxelFileName(outputFile, field));
+    octreeFiles.push_back(octreeFileName(outputFile, field));
 
-    char voxelFileName[10000];
-    sprintf(voxelFileName, "%s-%s", outputFile.c_str(), inputField.name().c_str());
-    std::string vFile(voxelFileName);
-    pData->saveVoxelsArrayData(vFile);
+    fieldDone.push_back(
+        isStageDone(checkpoint.get(), "octree-" + field.name()));
+    allFieldsDone &= fieldDone.back();
+  }
 
-    std::shared_ptr<VoxelOctree> voxelAccel = std::make_shared<VoxelOctree>(
-        pData->voxels.data(),
-        pData->voxels.size(),
-        pData->voxelRange,
-        box3f(pData->gridOrigin, vec3f(pData->dimensions)),
-        pData->gridWorldSpace,
-        pData->worldOrigin);
+  if (allFieldsDone && !unstructured) {
+    std::cout << green << "Nothing left to convert for " << outputFile << reset
+              << "\n";
+    return finishConversion(checkpoint.get());
+  }
+
+  if (directBuild) {
+    return convertDirect(*std::static_pointer_cast<exajetSource>(pData),
+                         checkpoint.get(),
+                         voxelFiles,
+                         octreeFiles,
+                         fieldDone);
+  }
 
+  if (inputDataType == "synthetic" || inputDataType == "exajet" ||
+      inputDataType == "landing") {
+    // the hexes and the first field are parsed once, every other field only
+    // streams its values into the same voxels
+    if (isStageDone(checkpoint.get(), "parse")) {
+      pData->mapMetaData(outputFile);
+      pData->readVoxelsArrayData(voxelFiles[0]);
+    } else {
+      // anything built from a previous parse is stale now
+      if (checkpoint)
+        checkpoint->clear();
+      fieldDone.assign(fieldDone.size(), false);
+      allFieldsDone = false;
+
+      time_point t1 = Time();
+      pData->parseData();
+      double loadTime = Time(t1);
+      std::cout << yellow << "Loading time: " << loadTime << " s" << reset
+                << "\n";
+      saveFieldRange(*pData, inputFields[0], pData->voxelRange);
+      pData->saveVoxelsArrayData(voxelFiles[0]);
+      markStageDone(
+          checkpoint.get(), "parse", {outputFile, voxelFiles[0] + ".vxl"});
+    }
 
-    // voxelAccel->printOctree();
-    voxelOctrees.push_back(voxelAccel);
+    // the topology is built from the first field so that the subtree
+    // checkpoints always hold the same values
+    if (!allFieldsDone) {
+      std::shared_ptr<VoxelOctree> voxelAccel = std::make_shared<VoxelOctree>(
+          pData->voxels.data(),
+          pData->voxels.size(),
+          pData->voxelRange,
+          box3f(pData->gridOrigin, vec3f(pData->dimensions)),
+          pData->gridWorldSpace,
+          pData->worldOrigin,
+          checkpoint.get());
+
+      // voxelAccel->printOctree();
+      voxelOctrees.push_back(voxelAccel);
+    }
   }
 
   // We could make this check earlier in the code for performance, i.e. don't
@@ -165,16 +474,49 @@ int main(int argc, const char **argv)
     pData->dumpUnstructured(outputFile);
   }
 
-  char octreeFileName[10000];
+  // every field is one timestep, the topology is stored once as the octree
+  // of the first field and the values go into <output>.tsoct
+  if (timeSeriesKeyframes > 0 && !voxelOctrees.empty()) {
+    std::shared_ptr<VoxelOctree> tree = voxelOctrees[0];
+    tree->saveOctree(octreeFiles[0]);
+    TimeSeriesOctreeWriter writer(
+        outputFile, octreeFiles[0] + ".oct", *tree, timeSeriesKeyframes);
+    for (size_t f = 0; f < inputFields.size(); f++) {
+      if (f > 0) {
+        pData->loadField(inputFields[f].str());
+        saveFieldRange(*pData, inputFields[f], pData->voxelRange);
+        tree->updateLeafValues(pData->voxels.data(), pData->voxels.size());
+      }
+      writer.addStep(*tree);
+    }
+    writer.finish();
+    return finishConversion(checkpoint.get());
+  }
+
   for (size_t i = 0; i < voxelOctrees.size(); i++) {
-    sprintf(octreeFileName,
-            "%s-%s%06i",
-            outputFile.c_str(),
-            inputField.name().c_str(),
-            (int)i);
-    std::string oFile(octreeFileName);
-    voxelOctrees[i]->saveOctree(oFile);
+    for (size_t f = 0; f < inputFields.size(); f++) {
+      if (fieldDone[f])
+        continue;
+
+      if (f > 0) {
+        time_point t1 = Time();
+        pData->loadField(inputFields[f].str());
+        saveFieldRange(*pData, inputFields[f], pData->voxelRange);
+        pData->saveVoxelsArrayData(voxelFiles[f]);
+        voxelOctrees[i]->updateLeafValues(pData->voxels.data(),
+                                          pData->voxels.size());
+        std::cout << yellow << "Field " << inputFields[f].name() << ": "
+                  << Time(t1) << " s" << reset << "\n";
+      }
+
+      voxelOctrees[i]->saveOctree(octreeFiles[f]);
+      std::vector<std::string> files = {octreeFiles[f] + ".oct",
+                                        octreeFiles[f] + ".octbin"};
+      if (f > 0)
+        files.push_back(voxelFiles[f] + ".vxl");
+      markStageDone(checkpoint.get(), "octree-" + inputFields[f].name(), files);
+    }
   }
 
-  return 0;
+  return finishConversion(checkpoint.get());
 }
@@ -0,0 +1,30 @@
+#include <stdexcept>
+
+#include "../ospray/TAMRVolume.h"
+#include "VolumeApp.h"
+
+/*! time the leaf lookups and the reconstruction filters of a tamr volume on
+ * random points and along rays, without rendering */
+int main(int argc, const char **argv)
+{
+  OSPError initError = ospInit(&argc, (const char **)argv);
+
+  if (initError != OSP_NO_ERROR)
+    return initError;
+
+  if (ospLoadModule("tamr") != OSP_NO_ERROR) {
+    throw std::runtime_error("failed to initialize TAMR module");
+  }
+
+  VolumeAppOptions options;
+  parseVolumeAppCommandLine(argc, argv, options);
+  OSPVolume volume = newTAMRVolume(options);
+
+  // the local device hands out the objects themselves, like the viewer
+  // does for the isosurface geometry
+  ((TAMRVolume *)volume)->runSamplingBenchmark(options.numPoints);
+
+  ospRelease(volume);
+  ospShutdown();
+  return 0;
+}
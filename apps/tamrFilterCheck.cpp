@@ -0,0 +1,33 @@
+#include <cstdlib>
+#include <stdexcept>
+
+#include "../ospray/TAMRVolume.h"
+#include "VolumeApp.h"
+
+/*! compare the ISPC reconstruction filters of a tamr volume with the
+ * host-side OctreeReconstruction; exits with a failure status if any
+ * sample disagrees beyond rounding */
+int main(int argc, const char **argv)
+{
+  OSPError initError = ospInit(&argc, (const char **)argv);
+
+  if (initError != OSP_NO_ERROR)
+    return initError;
+
+  if (ospLoadModule("tamr") != OSP_NO_ERROR) {
+    throw std::runtime_error("failed to initialize TAMR module");
+  }
+
+  VolumeAppOptions options;
+  parseVolumeAppCommandLine(argc, argv, options);
+  OSPVolume volume = newTAMRVolume(options);
+
+  // the local device hands out the objects themselves, like the viewer
+  // does for the isosurface geometry
+  const int mismatches =
+      ((TAMRVolume *)volume)->checkFilters(options.numPoints);
+
+  ospRelease(volume);
+  ospShutdown();
+  return mismatches > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,5 +1,6 @@
 #include <stdint.h>
 #include <stdio.h>
+#include <cmath>
 #include <cstdlib>
 #ifdef _WIN32
 #include <malloc.h>
@@ -23,9 +24,11 @@
 #include <memory>
 
 // #include "../ospray/DataQueryCallBack.h"
+#include "../ospray/TimeSeriesOctree.h"
 #include "../ospray/VoxelOctree.h"
 #include "dataImporter.h"
 #include "loader/meshloader.h"
+#include "loader/unstructuredLoader.h"
 #include "widgets/transfer_function_widget.h"
 
 #include "Utils.h"
@@ -36,6 +39,8 @@ using namespace ospcommon::math;
 std::string intputDataType;
 FileName inputOctFile;
 FileName inputIsosurfaceOctFile;
+//! optional '.tsoct' time series replacing the leaf values of the volume
+FileName inputTimeSeries;
 std::string inputField = "default";
 std::string isosurfaceField = "default";
 std::array<std::string, 2> colormapNames = { "", "" };
@@ -154,6 +159,10 @@ void parseCommandLine(int &ac, const char **&av, BenchmarkInfo& benchInfo)
       valueRanges[1].y = std::stof(av[i + 2]);
       removeArgs(ac, av, i, 3);
       --i;
+    } else if (arg == "-ts" || arg == "--timeseries") {
+      inputTimeSeries = av[i + 1];
+      removeArgs(ac, av, i, 2);
+      --i;
     } else if (arg == "--use-tf-widget") {
       std::cout << "note: tfwidget is now enabled by default\n";
       removeArgs(ac, av, i, 1);
@@ -275,6 +284,12 @@ void parseCommandLine(int &ac, const char **&av, BenchmarkInfo& benchInfo)
   }
 }
 
+//! pixel width at unit distance from the camera, for the adaptive sample
+//! counts of the tamr volumes
+float pixelFootprint(int windowHeight)
+{
+  return 2.f * std::tan(0.5f * fov * float(M_PI) / 180.f) / windowHeight;
+}
 
 int main(int argc, const char **argv)
 {
@@ -434,89 +449,27 @@ int main(int argc, const char **argv)
 
   std::vector<OSPVolume> volumes;
   std::vector<OSPVolumetricModel> volumetricModels;
+  //! backs the shared OSPData of the unstructured volumes, keep it alive
+  std::vector<std::shared_ptr<UnstructuredLoader>> unstructuredLoaders;
+  //! the volume decodes its timesteps from this, it has to outlive it
+  std::shared_ptr<TimeSeriesOctree> timeSeries;
+  if (!inputTimeSeries.str().empty()) {
+    t1 = Time();
+    timeSeries = std::make_shared<TimeSeriesOctree>(inputTimeSeries.str());
+    std::cout << yellow << "Loading time series takes " << Time(t1) << " s"
+              << reset << "\n";
+  }
 
   for (size_t i = 0; i < dataSources.size(); ++i) {
     OSPVolume curr_vol = 0;
     if(bInfo.currDataRep == DataRep::unstructured){
       // HACK: Ignoring InputIsosurfaceOctFile for now
-
-      //std::cout << "inputOctFile.path(): " << inputOctFile.path()  << std::endl;
-      std::string vert_fname = inputOctFile.path() + inputOctFile.base() + ".v.unstruct";
-      std::unique_ptr<vec3f[]> vertvals;
-      size_t vertvals_numbytes = -1;
-      // Below, I am using a code snippet from:
-      // http://www.cplusplus.com/doc/tutorial/files/
-      //
-      // Open the file "with the ios::ate flag, which means that the get
-      // pointer will be positioned at the end of the file. This way, when we
-      // call to member tellg(), we will directly obtain the size of the file."
-      ifstream vertvalfile (vert_fname, ios::in|ios::binary|ios::ate);
-      if (vertvalfile.is_open()) {
-        vertvals_numbytes = vertvalfile.tellg();
-        vertvals = std::unique_ptr<vec3f[]>(new vec3f[vertvals_numbytes]);
-        vertvalfile.seekg (0, ios::beg);
-        vertvalfile.read (reinterpret_cast<char*>(vertvals.get()), vertvals_numbytes);
-        std::cout << "Vertex values: read " << vertvals_numbytes << " bytes!" << std::endl;
-        vertvalfile.close();
-      } else {
-        throw new std::runtime_error("Could not open vert value file: " + vert_fname);
-      }
-      size_t num_vertvals = vertvals_numbytes / sizeof(vec3f); // HACK
-
-      // Read vertex array
-      std::string idx_fname = inputOctFile.path() + inputOctFile.base() + ".i.unstruct";
-      std::unique_ptr<vec4i[]> idxvals;
-      size_t idxvals_numbytes = -1;
-      ifstream indexfile (idx_fname, ios::in|ios::binary|ios::ate);
-      if (indexfile.is_open()) {
-        idxvals_numbytes = indexfile.tellg();
-        idxvals = std::unique_ptr<vec4i[]>(new vec4i[idxvals_numbytes]);
-        indexfile.seekg (0, ios::beg);
-        indexfile.read (reinterpret_cast<char*>(idxvals.get()), idxvals_numbytes);
-        std::cout << "Index values: read " << idxvals_numbytes << " bytes!" << std::endl;
-        indexfile.close();
-      } else {
-        throw new std::runtime_error("Could not open index value file: " + idx_fname);
-      }
-      size_t num_idxvals = idxvals_numbytes / sizeof(vec4i); // HACK
-
-      // Read index array
-      std::string field_fname = inputOctFile.path() + inputOctFile.base() + ".f.unstruct";
-      std::unique_ptr<float[]> fieldvals;
-      size_t fieldvals_numbytes = -1;
-      ifstream fieldvalfile (field_fname, ios::in|ios::binary|ios::ate);
-      if (fieldvalfile.is_open()) {
-        fieldvals_numbytes = fieldvalfile.tellg();
-        fieldvals = std::unique_ptr<float[]>(new float[fieldvals_numbytes]);
-        fieldvalfile.seekg (0, ios::beg);
-        fieldvalfile.read (reinterpret_cast<char*>(fieldvals.get()), fieldvals_numbytes);
-        std::cout << "Field values: read " << fieldvals_numbytes << " bytes!" << std::endl;
-        fieldvalfile.close();
-      } else {
-        throw new std::runtime_error("Could not open field value file: " + field_fname);
-      }
-      size_t num_fieldvals = fieldvals_numbytes / sizeof(float); // HACK
-
-      // Create OSPData arrays for verts, indices, field values
-      //OSPData vtxData = ospNewData(verts.size(), OSP_VEC3F, verts.data());
-      OSPData vtxData = ospNewData(num_vertvals, OSP_VEC3F, vertvals.get());
-      //OSPData idxData = ospNewData(idxs.size(), OSP_VEC4I, idxs.data());
-      OSPData idxData = ospNewData(num_idxvals, OSP_VEC4I, idxvals.get());
-      OSPData cellFieldData = ospNewData(num_fieldvals, OSP_FLOAT, fieldvals.get());
-
-      // Create cell type array, and create a matching OSPData object
-      std::vector<char> cell_types;
-      cell_types.resize(num_fieldvals); // size is the number of cells
-      for (int i = 0; i < cell_types.size(); ++i) {
-        cell_types[i] = OSP_HEXAHEDRON;
-      }
-      OSPData typeData = ospNewData(cell_types.size(), OSP_UCHAR, cell_types.data());
-
-      // Call OSPCommit on the above OSPData arrays
-      ospCommit(vtxData);
-      ospCommit(idxData);
-      ospCommit(cellFieldData);
-      ospCommit(typeData);
+      t1 = Time();
+      auto loader = std::make_shared<UnstructuredLoader>(
+          inputOctFile.path() + inputOctFile.base());
+      unstructuredLoaders.push_back(loader);
+      std::cout << yellow << "Loading unstructured mesh takes " << Time(t1)
+                << " s" << reset << "\n";
 
       // Create a new OSPVolume
       curr_vol = ospNewVolume("unstructured_volume");
@@ -525,10 +478,7 @@ int main(int argc, const char **argv)
       // function appears to be bound to an OSPVolumetricModel.
 
       // Bind data arrays to the OSPVolume
-      ospSetData(curr_vol, "vertex.position", vtxData);
-      ospSetData(curr_vol, "cell.value", cellFieldData);
-      ospSetData(curr_vol, "index", idxData);
-      ospSetData(curr_vol, "cell.type", typeData);
+      loader->setVolumeData(curr_vol);
       // The following optimization assumes hexes have planar sides.
       // In the case of our TAMR data, this should always be true.
       ospSetString(curr_vol, "hexMethod", "planar");
@@ -560,7 +510,15 @@ int main(int argc, const char **argv)
                   src->dimensions.z);
 
       ospSetVoidPtr(curr_vol, "voxelOctree", (void *)voxelOctrees[i].get());
+      if (timeSeries && i == 0) {
+        ospSetVoidPtr(curr_vol, "timeSeries", (void *)timeSeries.get());
+        ospSetInt(curr_vol, "timestep", 0);
+      }
       ospSetInt(curr_vol, "gradientShadingEnabled", 0);
+      // updated in the UI callback when the window is resized
+      ospSetFloat(curr_vol, "pixelFootprint", pixelFootprint(windowDims.y));
+      // lets the volume precompute which nodes are visible
+      ospSetObject(curr_vol, "transferFunction", transferFcns[i]);
     }
     if (curr_vol == 0)
       throw std::runtime_error("Null pointer to OSPVolume!");
@@ -608,15 +566,18 @@ int main(int argc, const char **argv)
     std::cout << yellow << "Loading input cell data takes: " << loadPointTime
               << " s" << reset << "\n";
 
+    // Impi only reads the cells during commit, so the mapping is handed over
+    // as is instead of being copied into pData->voxels first
     OSPGeometry geometry = ospNewGeometry("impi");
     ospSetFloat(geometry, "isoValue", isoValue);
-    size_t numVoxels = pData->voxels.size();
+    size_t numVoxels = pData->voxelNum;
     ospSetVoidPtr(geometry, "TAMRVolume", (void *)volumes[0]);
-    ospSetVoidPtr(geometry, "inputVoxels", (void *)pData->voxels.data());
+    ospSetVoidPtr(geometry, "inputVoxels", (void *)pData->mappedVoxels);
     ospSetVoidPtr(geometry, "numInputVoxels", (void *)&numVoxels);
     ospSetInt(volumes[0], "gradientShadingEnabled", 1);
     ospCommit(volumes[0]);
     ospCommit(geometry);
+    pData->unmapVoxelsArrayData();
 
     OSPMaterial dataMat = ospNewMaterial(rendererName.c_str(), "default");
     ospSetVec3f(dataMat, "Kd", 1.f, 1.f, 1.f);
@@ -712,6 +673,24 @@ int main(int argc, const char **argv)
     static int spp = 1;
     static int samplesPerCell = 1;
     static int samplingRate = 5;
+    static int valueCacheLog2Size = 0;
+    static bool preIntegration = false;
+    static float errorBudget    = 0.f;
+
+    // the framebuffer follows the window size; moving the camera keeps the
+    // footprint at unit distance, only the height and the fov change it
+    static int footprintHeight = windowDims.y;
+    int framebufferWidth = 0, framebufferHeight = 0;
+    glfwGetFramebufferSize(
+        glfwGetCurrentContext(), &framebufferWidth, &framebufferHeight);
+    if (framebufferHeight > 0 && framebufferHeight != footprintHeight &&
+        bInfo.currDataRep != DataRep::unstructured) {
+      footprintHeight = framebufferHeight;
+      for (auto vol : volumes) {
+        ospSetFloat(vol, "pixelFootprint", pixelFootprint(footprintHeight));
+        glfwOSPRayWindow->addObjectToCommit(vol);
+      }
+    }
     if (ImGui::SliderInt("spp", &spp, 1, 64)) {
       ospSetInt(renderer, "spp", spp);
       glfwOSPRayWindow->addObjectToCommit(renderer);
@@ -725,11 +704,42 @@ int main(int argc, const char **argv)
       glfwOSPRayWindow->addObjectToCommit(volumes[0]);
     }
 
+    if (ImGui::SliderInt("value cache (log2)", &valueCacheLog2Size, 0, 24)) {
+      ospSetInt(volumes[0], "valueCacheLog2Size", valueCacheLog2Size);
+      glfwOSPRayWindow->addObjectToCommit(volumes[0]);
+    }
+
+    if (ImGui::SliderFloat("sampling error budget", &errorBudget, 0.f, 4.f)) {
+      ospSetFloat(volumes[0], "samplingErrorBudget", errorBudget);
+      glfwOSPRayWindow->addObjectToCommit(volumes[0]);
+    }
+
+    if (ImGui::Checkbox("pre-integration", &preIntegration)) {
+      ospSetInt(volumes[0], "preIntegration", preIntegration);
+      glfwOSPRayWindow->addObjectToCommit(volumes[0]);
+    }
+
     if (ImGui::SliderInt("samplingRange", &samplingRate, 1, 160)) {
       ospSetFloat(volumetricModels[0], "samplingRate", samplingRate);
       glfwOSPRayWindow->addObjectToCommit(volumetricModels[0]);
     }
 
+    if (timeSeries) {
+      static int timestep = 0;
+      static bool play    = false;
+      bool stepChanged    = ImGui::SliderInt(
+          "timestep", &timestep, 0, timeSeries->numSteps() - 1);
+      ImGui::Checkbox("play", &play);
+      if (play) {
+        timestep    = (timestep + 1) % timeSeries->numSteps();
+        stepChanged = true;
+      }
+      if (stepChanged) {
+        ospSetInt(volumes[0], "timestep", timestep);
+        glfwOSPRayWindow->addObjectToCommit(volumes[0]);
+      }
+    }
+
 
     if (rendererName != "scivis") {
         ImGui::PushID(1);
@@ -793,6 +803,8 @@ int main(int argc, const char **argv)
             auto range = tfnWidgets[i].get_current_range();
             ospSetVec2f(transferFcns[i], "valueRange", range[0], range[1]);
             glfwOSPRayWindow->addObjectToCommit(transferFcns[i]);
+            if (bInfo.currDataRep != DataRep::unstructured)
+              glfwOSPRayWindow->addObjectToCommit(volumes[i]);
             ospRelease(colors);
             ospRelease(opacities);
         }
@@ -803,6 +815,7 @@ int main(int argc, const char **argv)
   glfwOSPRayWindow->mainLoop();
 
   ospRelease(renderer);
+  unstructuredLoaders.clear();
   // cleanly shut OSPRay down
   ospShutdown();
 
@@ -0,0 +1,48 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "DualValueCache.h"
+
+void DualValueCache::resize(int log2Size)
+{
+  if (log2Size < 0 || log2Size > 30)
+    throw std::runtime_error(
+        "DualValueCache error: log2 of the size must be 0 (off) to 30!");
+
+  const size_t numSlots = log2Size > 0 ? size_t(1) << log2Size : 0;
+  if (numSlots == size())
+    return;
+
+  std::vector<uint64_t>(2 * numSlots, 0).swap(slots);
+  epoch = 1;
+}
+
+void DualValueCache::clear()
+{
+  for (auto &s : stats) {
+    s.lookups = 0;
+    s.hits    = 0;
+  }
+
+  // the epoch shares the key word with the key
+  if (++epoch == uint64_t(1) << (64 - keyBits)) {
+    std::fill(slots.begin(), slots.end(), 0);
+    epoch = 1;
+  }
+}
+
+int64_t DualValueCache::lookups() const
+{
+  int64_t sum = 0;
+  for (const auto &s : stats)
+    sum += s.lookups;
+  return sum;
+}
+
+int64_t DualValueCache::hits() const
+{
+  int64_t sum = 0;
+  for (const auto &s : stats)
+    sum += s.hits;
+  return sum;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*! Fixed-size, lock-free hash table of reconstructed octant corner values,
+ * shared by all render threads (the ISPC side is DualValueCache.ih).
+ *
+ * Neighboring rays gather the same dual cells and stitch the same corners
+ * in doOctant() / doTrilinear(); with the cache each (leaf, octant) is
+ * stitched about once per epoch. Entries are never removed, a colliding
+ * store overwrites the slot, or is dropped while another thread writes it.
+ * Each slot is guarded by a sequence lock, so readers never see a key with
+ * another key's value. Only corners of the octant a sample lies in are
+ * published, not those of recursive fills or of points on a center plane.
+ * clear() starts a new epoch, which invalidates every entry without
+ * touching the table.
+ */
+class DualValueCache
+{
+ public:
+  //! one cache line of counters, must match DualValueCacheStats
+  struct alignas(64) Stats
+  {
+    int64_t lookups{0};
+    int64_t hits{0};
+    int64_t pad[6];
+  };
+
+  //! must match DVC_KEY_BITS and DVC_STAT_STRIPES in DualValueCache.ih
+  static constexpr int keyBits    = 47;
+  static constexpr int numStripes = 64;
+  //! node IDs have to fit into the key next to method, octant and corner
+  static constexpr uint64_t maxNodes = uint64_t(1) << (keyBits - 7);
+
+  //! 2^log2Size slots of 16 bytes, 0 turns the cache off
+  void resize(int log2Size);
+  //! drop all entries and reset the counters
+  void clear();
+  //! the render threads only count lookups and hits when asked to, the
+  //! shared counters cost them an atomic add per lookup
+  void enableStats(bool on) { countStats = on; }
+  bool statsEnabled() const { return countStats; }
+
+  bool enabled() const { return !slots.empty(); }
+  size_t size() const { return slots.size() / 2; }
+
+  void *slotData() { return enabled() ? slots.data() : nullptr; }
+  //! NULL unless statsEnabled()
+  void *statsData() { return countStats ? stats.data() : nullptr; }
+  uint64_t currentEpoch() const { return epoch; }
+
+  //! octant lookups and full hits since the last clear()
+  int64_t lookups() const;
+  int64_t hits() const;
+
+ private:
+  std::vector<uint64_t> slots;
+  std::vector<Stats> stats{std::vector<Stats>(numStripes)};
+  //! key words start out as 0, so epoch 0 is never current
+  uint64_t epoch{1};
+  bool countStats{false};
+};
@@ -0,0 +1,1305 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "VoxelOctree.h"
+#include "ospcommon/math/box.h"
+#include "ospcommon/tasking/parallel_for.h"
+
+/*! Host-side implementation of the five reconstruction filters of
+ * TAMRVolume (filter_*.ispc, octant_stitch.ih), for batch post-processing
+ * and for checking the ISPC kernels.
+ *
+ * The reconstructions follow the ISPC code step by step, only the value
+ * type T (float or double) is a parameter; with T = float the results
+ * match the renderer up to the rounding of rcp(). The per-ray LeafHint and
+ * NeighborCache are left out, they only make repeated lookups cheaper.
+ *
+ * An OctreeReconstruction never changes after construction and keeps all
+ * temporaries on the stack, so any number of threads can sample it at
+ * once without locking or allocating. The nodes must outlive it.
+ */
+template <typename T>
+class OctreeReconstruction
+{
+ public:
+  //! same order as TAMRBatchSampler::Filter
+  enum Filter
+  {
+    NEAREST = 0,
+    CURRENT,
+    FINEST,
+    OCTANT,
+    TRILINEAR
+  };
+
+  /*! reconstruct from 'nodes', which share the topology and bounds of
+   * 'octree' (e.g. one decoded timestep of a TimeSeriesOctree). World
+   * coordinates map to the grid like in TAMRVolume: (P - worldOrigin) /
+   * gridWorldSpace + gridOrigin. */
+  OctreeReconstruction(const VoxelOctree &octree,
+                       const VoxelOctreeNode *nodes,
+                       size_t numNodes,
+                       const vec3f &worldOrigin,
+                       const vec3f &gridOrigin,
+                       const vec3f &gridWorldSpace)
+      : nodes(nodes),
+        numNodes(numNodes),
+        actualBounds(octree._actualBounds),
+        virtualBounds(octree._virtualBounds),
+        worldOrigin(worldOrigin),
+        gridOrigin(gridOrigin),
+        gridWorldSpace(gridWorldSpace)
+  {
+  }
+
+  //! the octree's own nodes and world placement
+  explicit OctreeReconstruction(const VoxelOctree &octree)
+      : OctreeReconstruction(octree,
+                             octree._octreeNodes.data(),
+                             octree._octreeNodes.size(),
+                             octree._worldOrigin,
+                             vec3f(0.f),
+                             octree._gridWorldSpace)
+  {
+  }
+
+  vec3f worldToGrid(const vec3f &P) const
+  {
+    return (P - worldOrigin) / gridWorldSpace + gridOrigin;
+  }
+
+  //! reconstruct at the world space position P
+  T sample(Filter filter, const vec3f &P) const
+  {
+    return sampleGrid(filter, worldToGrid(P));
+  }
+
+  //! reconstruct at the grid space position lP
+  T sampleGrid(Filter filter, const vec3f &lP) const
+  {
+    switch (filter) {
+    case NEAREST:
+      return nearest(lP);
+    case CURRENT:
+      return current(lP);
+    case FINEST:
+      return finest(lP);
+    case OCTANT:
+      return octant(lP);
+    case TRILINEAR:
+      return trilinear(lP);
+    }
+    return T(0);
+  }
+
+  T nearest(const vec3f &lP) const
+  {
+    return findLeafCell(lP).value;
+  }
+
+  T current(const vec3f &lP) const
+  {
+    const CellRef cell = findLeafCell(lP);
+    if (cell.value == T(0))
+      return cell.value;
+
+    DualCell D;
+    initDualCell(D, lP, cell.width);
+    findDualCell(D);
+    return lerp(D.value, D.weights);
+  }
+
+  T finest(const vec3f &lP) const
+  {
+    const CellRef cell = findLeafCell(lP);
+    if (cell.value == T(0))
+      return cell.value;
+
+    DualCell D;
+    initDualCell(D, lP, 1.f);
+    findDualCell(D);
+    return lerp(D.value, D.weights);
+  }
+
+  T octant(const vec3f &lP) const
+  {
+    const CellRef cell = findLeafCell(lP);
+    if (cell.value == T(0))
+      return cell.value;
+
+    Octant O;
+    DualCell D;
+    return doOctant(cell, lP, O, D);
+  }
+
+  T trilinear(const vec3f &lP) const
+  {
+    const CellRef cell = findLeafCell(lP);
+    if (cell.value == T(0))
+      return cell.value;
+
+    Octant O;
+    DualCell D;
+    return doTrilinear(cell, lP, O, D);
+  }
+
+  /*! bulk resampling: values[i] = sample(filter, positions[i]) for
+   * numPoints world space positions, in parallel tiles */
+  void resample(Filter filter,
+                const vec3f *positions,
+                T *values,
+                size_t numPoints) const
+  {
+    const size_t numTiles = (numPoints + tileSize - 1) / tileSize;
+    tasking::parallel_for(numTiles, [&](size_t tileID) {
+      const size_t begin = tileID * tileSize;
+      const size_t end   = std::min(numPoints, begin + tileSize);
+      for (size_t i = begin; i < end; i++)
+        values[i] = sample(filter, positions[i]);
+    });
+  }
+
+  /*! resample onto the cell centers of a dims.x * dims.y * dims.z grid
+   * spanning 'worldBounds', x fastest, one task per z slice */
+  void resample(Filter filter,
+                const box3f &worldBounds,
+                const vec3i &dims,
+                T *values) const
+  {
+    const vec3f spacing = worldBounds.size() / vec3f(dims);
+    tasking::parallel_for(dims.z, [&](int z) {
+      T *slice = values + size_t(z) * dims.x * dims.y;
+      for (int y = 0; y < dims.y; y++) {
+        for (int x = 0; x < dims.x; x++) {
+          const vec3f P =
+              worldBounds.lower + (vec3f(x, y, z) + vec3f(0.5f)) * spacing;
+          slice[size_t(y) * dims.x + x] = sample(filter, P);
+        }
+      }
+    });
+  }
+
+  //! world space bounds of the leaf P is reconstructed in
+  box3f leafBounds(const vec3f &P) const
+  {
+    const CellRef cell = findLeafCell(worldToGrid(P));
+    const vec3f lower  = worldOrigin + (cell.pos - gridOrigin) * gridWorldSpace;
+    return box3f(lower, lower + vec3f(cell.width) * gridWorldSpace);
+  }
+
+  //! points per task of the bulk resampling
+  size_t tileSize{4096};
+
+ private:
+  //! see CellRef in FindCell.ih
+  struct CellRef
+  {
+    vec3f pos;
+    float width;
+    T value;
+  };
+
+  //! see DualCell in FindDualCell.ih
+  struct DualCell
+  {
+    vec3f pos;
+    float width;
+    vec3f weights;
+
+    T value[8];
+    float actualWidth[8];
+    bool isLeaf[8];
+  };
+
+  //! see Octant in Octant.ih
+  struct Octant
+  {
+    vec3f signs;
+    vec3i mirror;
+    vec3f center;
+    vec3f vertex;
+    vec3f weights;
+    T value[8];
+  };
+
+  enum Corner
+  {
+    C000 = 0,
+    C001,
+    C010,
+    C011,
+    C100,
+    C101,
+    C110,
+    C111
+  };
+
+  enum VertexTopo
+  {
+    IDENTIFY = 0,
+    EDGE,
+    FACEDIAG,
+    DIAG
+  };
+
+  //! offset into neighboring cells, relative to the cell width
+  static constexpr float delta = 0.01f;
+
+  // ------------------------------------------------------------------
+  // tree access, see VoxelOctree.ih and FindCell.ih
+  // ------------------------------------------------------------------
+  static bool isLeaf(const VoxelOctreeNode &node)
+  {
+    return node.isLeaf == 1;
+  }
+
+  static uint8_t childMask(const VoxelOctreeNode &node)
+  {
+    return node.childDescripteOrValue & 0xFF;
+  }
+
+  static uint64_t childOffset(const VoxelOctreeNode &node)
+  {
+    return node.childDescripteOrValue >> 8;
+  }
+
+  static T valueOf(const VoxelOctreeNode &node)
+  {
+    return T(uintBitsToDouble(node.childDescripteOrValue));
+  }
+
+  static vec3f floorOf(const vec3f &v)
+  {
+    return vec3f(std::floor(v.x), std::floor(v.y), std::floor(v.z));
+  }
+
+  static vec3f clampTo(const vec3f &v, const vec3f &lo, const vec3f &hi)
+  {
+    return min(max(v, lo), hi);
+  }
+
+  static bool isCoarser(float width, const CellRef &C)
+  {
+    return width > C.width;
+  }
+
+  //! see fillsFromCoarser() in octant_stitch.ih
+  static bool fillsFromCoarser(const CellRef &fillFrom, const CellRef &C)
+  {
+    return isCoarser(fillFrom.width, C);
+  }
+
+  static vec3f centerOf(const CellRef &C)
+  {
+    return C.pos + vec3f(0.5f * C.width);
+  }
+
+  static bool descendToChild(const VoxelOctreeNode &node,
+                             const vec3f &localCoord,
+                             uint64_t &nodeID,
+                             vec3f &pos,
+                             float &cellWidth)
+  {
+    const float halfWidth = 0.5f * cellWidth;
+    const vec3f center    = pos + vec3f(halfWidth);
+
+    uint8_t octantMask = 0;
+    if (localCoord.x >= center.x)
+      octantMask |= 1;
+    if (localCoord.y >= center.y)
+      octantMask |= 2;
+    if (localCoord.z >= center.z)
+      octantMask |= 4;
+
+    const uint8_t mask = childMask(node);
+    if (!(mask & (1 << octantMask)))
+      return false;
+
+    const uint8_t rightSibling = (1 << octantMask) - 1;
+    nodeID += childOffset(node) + CHILD_BIT_COUNT[mask & rightSibling];
+
+    pos = pos + vec3f((octantMask & 1) ? halfWidth : 0.f,
+                      (octantMask & 2) ? halfWidth : 0.f,
+                      (octantMask & 4) ? halfWidth : 0.f);
+    cellWidth = halfWidth;
+    return true;
+  }
+
+  CellRef findLeafCell(const vec3f &_localCoord) const
+  {
+    const vec3f gridOrigin = virtualBounds.lower;
+    const float width      = virtualBounds.size().x;
+
+    const vec3f localCoord = clampTo(
+        _localCoord, vec3f(0.f), actualBounds.upper - vec3f(0.000001f));
+
+    uint64_t nodeID = 0;
+    vec3f pos       = gridOrigin;
+    float cellWidth = width;
+
+    for (int depth = 0; depth < 64; depth++) {
+      if (nodeID >= numNodes)
+        return {pos, cellWidth, T(-1)};
+
+      const VoxelOctreeNode &node = nodes[nodeID];
+      if (isLeaf(node))
+        return {pos, cellWidth, valueOf(node)};
+
+      // no leaf (no voxel), return the invalid value 0
+      if (!descendToChild(node, localCoord, nodeID, pos, cellWidth))
+        return {pos, cellWidth * 0.5f, T(0)};
+    }
+    return {gridOrigin, width, T(-3)};
+  }
+
+  // ------------------------------------------------------------------
+  // dual cells, see FindDualCell.ih/.ispc
+  // ------------------------------------------------------------------
+  static void initDualCell(DualCell &D, const vec3f &P, float cellWidth)
+  {
+    const float halfCellWidth = cellWidth * 0.5f;
+    const float rcpCellWidth  = 1.f / cellWidth;
+    const vec3f xfmed         = (P - halfCellWidth) * rcpCellWidth;
+    const vec3f f_idx         = floorOf(xfmed);
+    D.pos                     = f_idx * cellWidth + halfCellWidth;
+    D.width                   = cellWidth;
+    D.weights                 = xfmed - f_idx;
+  }
+
+  static T lerp(const T *f, const vec3f &w)
+  {
+    const T f00 = (1.f - w.x) * f[C000] + w.x * f[C001];
+    const T f01 = (1.f - w.x) * f[C010] + w.x * f[C011];
+    const T f10 = (1.f - w.x) * f[C100] + w.x * f[C101];
+    const T f11 = (1.f - w.x) * f[C110] + w.x * f[C111];
+
+    const T f0 = (1.f - w.y) * f00 + w.y * f01;
+    const T f1 = (1.f - w.y) * f10 + w.y * f11;
+
+    return (1.f - w.z) * f0 + w.z * f1;
+  }
+
+  //! same walk as gatherDualCorners(), without a hint
+  void gatherDualCorners(const vec3f *corners, DualCell &D) const
+  {
+    const vec3f gridOrigin = virtualBounds.lower;
+    const float width      = virtualBounds.size().x;
+
+    for (int i = 0; i < 8; i++) {
+      D.value[i]       = T(-1);
+      D.actualWidth[i] = 0.f;
+      D.isLeaf[i]      = false;
+    }
+
+    const vec3f boxLo = min(corners[C000], corners[C111]);
+    const vec3f boxHi = max(corners[C000], corners[C111]);
+
+    uint64_t nodeID = 0;
+    vec3f pos       = gridOrigin;
+    float cellWidth = width;
+
+    // descend while all corners fall into the same child
+    for (int level = 0; level < 64; level++) {
+      if (nodeID >= numNodes)
+        return;
+
+      const VoxelOctreeNode &node = nodes[nodeID];
+      if (isLeaf(node))
+        break;
+
+      const vec3f center = pos + vec3f(cellWidth * 0.5f);
+      const bool splitX  = (boxLo.x >= center.x) != (boxHi.x >= center.x);
+      const bool splitY  = (boxLo.y >= center.y) != (boxHi.y >= center.y);
+      const bool splitZ  = (boxLo.z >= center.z) != (boxHi.z >= center.z);
+      if (splitX || splitY || splitZ)
+        break;
+
+      if (!descendToChild(node, boxLo, nodeID, pos, cellWidth))
+        break;
+    }
+
+    struct StackEntry
+    {
+      uint8_t queryPointMask;
+      uint64_t nodeID;
+      vec3f pos;
+      float width;
+    };
+    // every corner is on at most one entry per level
+    StackEntry stack[128];
+    StackEntry *stackPtr = stack;
+    *stackPtr++          = {0xFF, nodeID, pos, cellWidth};
+
+    while (stackPtr > stack) {
+      const StackEntry e = *--stackPtr;
+      if (e.nodeID >= numNodes)
+        break;
+
+      const VoxelOctreeNode &node = nodes[e.nodeID];
+      if (isLeaf(node)) {
+        for (int i = 0; i < 8; i++) {
+          if (e.queryPointMask & (1 << i)) {
+            D.value[i]       = valueOf(node);
+            D.actualWidth[i] = e.width;
+            D.isLeaf[i]      = (D.width == e.width);
+          }
+        }
+        continue;
+      }
+
+      const vec3f center = e.pos + vec3f(e.width * 0.5f);
+
+      uint8_t pointsInOctant[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+      for (int i = 0; i < 8; i++) {
+        if (e.queryPointMask & (1 << i)) {
+          uint8_t oMask = 0;
+          oMask |= (corners[i].x >= center.x) ? 1 : 0;
+          oMask |= (corners[i].y >= center.y) ? 2 : 0;
+          oMask |= (corners[i].z >= center.z) ? 4 : 0;
+          pointsInOctant[oMask] |= (1 << i);
+        }
+      }
+
+      const uint8_t mask = childMask(node);
+      for (int o = 0; o < 8; o++) {
+        if (!pointsInOctant[o])
+          continue;
+
+        if (!(mask & (1 << o))) {
+          // no leaf, return the invalid value 0
+          for (int j = 0; j < 8; j++) {
+            if (pointsInOctant[o] & (1 << j)) {
+              D.value[j]       = T(0);
+              D.actualWidth[j] = D.width;
+              D.isLeaf[j]      = (D.width == e.width * 0.5f);
+            }
+          }
+        } else {
+          const uint8_t rightSibling = (1 << o) - 1;
+          const uint64_t childID =
+              e.nodeID + childOffset(node) + CHILD_BIT_COUNT[mask & rightSibling];
+          const float halfWidth = e.width * 0.5f;
+          const vec3f lowerPos  = e.pos + vec3f((o & 1) ? halfWidth : 0.f,
+                                               (o & 2) ? halfWidth : 0.f,
+                                               (o & 4) ? halfWidth : 0.f);
+          *stackPtr++ = {pointsInOctant[o], childID, lowerPos, halfWidth};
+        }
+      }
+    }
+  }
+
+  static void cornersOf(const float lo[3], const float hi[3], vec3f *corners)
+  {
+    for (int i = 0; i < 8; i++) {
+      corners[i] = vec3f((i & 1) ? hi[0] : lo[0],
+                         (i & 2) ? hi[1] : lo[1],
+                         (i & 4) ? hi[2] : lo[2]);
+    }
+  }
+
+  void findDualCell(DualCell &D) const
+  {
+    findMirroredDualCell(vec3i(0), D);
+  }
+
+  void findMirroredDualCell(const vec3i &mirror, DualCell &D) const
+  {
+    const vec3f P0 = clampTo(D.pos, vec3f(0.f), actualBounds.upper);
+    const vec3f P1 = clampTo(D.pos + D.width,
+                             vec3f(0.f),
+                             actualBounds.upper - vec3f(0.000001f));
+
+    const float lo[3] = {mirror.x ? P1.x : P0.x,
+                         mirror.y ? P1.y : P0.y,
+                         mirror.z ? P1.z : P0.z};
+    const float hi[3] = {mirror.x ? P0.x : P1.x,
+                         mirror.y ? P0.y : P1.y,
+                         mirror.z ? P0.z : P1.z};
+
+    vec3f corners[8];
+    cornersOf(lo, hi, corners);
+    gatherDualCorners(corners, D);
+  }
+
+  // ------------------------------------------------------------------
+  // octant method, see octant_stitch.ih
+  // ------------------------------------------------------------------
+  static void initOctant(Octant &O, DualCell &D, const vec3f &P, const CellRef &C)
+  {
+    const float cellWidth     = C.width;
+    const float halfCellWidth = cellWidth * 0.5f;
+    const float rcpCellWidth  = 1.f / cellWidth;
+
+    const vec3f CC = centerOf(C);
+    const bool left_x = P.x <= CC.x;
+    const bool left_y = P.y <= CC.y;
+    const bool left_z = P.z <= CC.z;
+    O.mirror = vec3i(left_x ? 1 : 0, left_y ? 1 : 0, left_z ? 1 : 0);
+    O.signs  = vec3f(left_x ? -1.f : +1.f, left_y ? -1.f : +1.f, left_z ? -1.f : +1.f);
+
+    // the dual cell between C's center and the octant's vertex
+    D.pos   = vec3f(left_x ? CC.x - cellWidth : CC.x,
+                    left_y ? CC.y - cellWidth : CC.y,
+                    left_z ? CC.z - cellWidth : CC.z);
+    D.width = cellWidth;
+
+    const vec3f t      = (P - D.pos) * rcpCellWidth;
+    const vec3f weight = vec3f(std::min(std::max(t.x, 0.f), 1.f),
+                               std::min(std::max(t.y, 0.f), 1.f),
+                               std::min(std::max(t.z, 0.f), 1.f));
+    D.weights = vec3f(O.mirror.x ? (1 - weight.x) : weight.x,
+                      O.mirror.y ? (1 - weight.y) : weight.y,
+                      O.mirror.z ? (1 - weight.z) : weight.z);
+
+    O.center = CC;
+    O.vertex = O.center + O.signs * halfCellWidth;
+
+    const vec3f d = P - O.center;
+    O.weights     = vec3f(std::abs(d.x), std::abs(d.y), std::abs(d.z)) *
+                (2.f * rcpCellWidth);
+  }
+
+  void findDualAndInitOctant(Octant &O,
+                             DualCell &D,
+                             const vec3f &P,
+                             const CellRef &C) const
+  {
+    initOctant(O, D, P, C);
+    findMirroredDualCell(O.mirror, D);
+  }
+
+  //! hats from leaves only on the current level
+  T coarseBoundaryValue(const vec3f &P, float currentWidth) const
+  {
+    DualCell D;
+    initDualCell(D, P, currentWidth);
+    findDualCell(D);
+    return lerp(D.value, D.weights);
+  }
+
+  //! point a corner is filled from, in the neighbor across sides 'sides'
+  vec3f neighborPos(const Octant &O, const CellRef &C, int sides) const
+  {
+    const float step = (0.5f + delta) * C.width;
+    return vec3f((sides & 1) ? O.center.x + step * O.signs.x : O.center.x,
+                 (sides & 2) ? O.center.y + step * O.signs.y : O.center.y,
+                 (sides & 4) ? O.center.z + step * O.signs.z : O.center.z);
+  }
+
+  /*! the corners of O that have to be filled from a coarser neighbor:
+   * side, edge and vertex corners whose coarsest neighbor is coarser than
+   * C. Deferred corners get the lookup position in needToFillFrom. */
+  template <typename FillSide, typename FillEdge, typename FillVertex>
+  void fillOctantCorners(const CellRef &C,
+                         Octant &O,
+                         const DualCell &D,
+                         bool *done,
+                         CellRef *needToFillFrom,
+                         const FillSide &fillSide,
+                         const FillEdge &fillEdge,
+                         const FillVertex &fillVertex) const
+  {
+    // the center point is always the cell value
+    O.value[C000] = C.value;
+    done[C000]    = true;
+
+    // sides touch one neighbor: interpolate on the same level, defer to a
+    // coarser neighbor, or fill from our side if the neighbor is finer
+    for (int side : {C001, C010, C100}) {
+      if (D.actualWidth[side] == C.width) {
+        O.value[side] = 0.5f * (C.value + D.value[side]);
+        done[side]    = true;
+      } else if (isCoarser(D.actualWidth[side], C)) {
+        needToFillFrom[side].pos   = neighborPos(O, C, side);
+        needToFillFrom[side].width = D.actualWidth[side];
+        done[side]                 = false;
+      } else {
+        O.value[side] = fillSide(side);
+        done[side]    = true;
+      }
+    }
+
+    // edges touch three neighbors: defer to the coarsest if any is
+    // coarser, average if all are leaves on our level, else fill
+    for (int edge : {C011, C101, C110}) {
+      const int a = edge & C001 ? C001 : C010;
+      const int b = edge & C100 ? C100 : C010;
+      const float maxWidth =
+          std::max({D.actualWidth[a], D.actualWidth[b], D.actualWidth[edge]});
+      const bool allLeaves = D.isLeaf[a] & D.isLeaf[b] & D.isLeaf[edge];
+      if (isCoarser(maxWidth, C)) {
+        needToFillFrom[edge] = C;
+        for (int n : {a, b, edge}) {
+          if (isCoarser(D.actualWidth[n], needToFillFrom[edge])) {
+            needToFillFrom[edge].pos   = neighborPos(O, C, n);
+            needToFillFrom[edge].width = D.actualWidth[n];
+          }
+        }
+        done[edge] = false;
+      } else if (!allLeaves) {
+        O.value[edge] = fillEdge(edge);
+        done[edge]    = true;
+      } else {
+        O.value[edge] =
+            0.25f * (C.value + D.value[a] + D.value[b] + D.value[edge]);
+        done[edge] = true;
+      }
+    }
+
+    // the vertex touches all seven neighbors
+    const float maxWidth =
+        *std::max_element(D.actualWidth, D.actualWidth + 8);
+    bool allLeaves = true;
+    for (int i = 0; i < 8; i++)
+      allLeaves &= D.isLeaf[i];
+    if (maxWidth == C.width && allLeaves) {
+      T sum = T(0);
+      for (int i = 0; i < 8; i++)
+        sum += D.value[i];
+      O.value[C111] = 0.125f * sum;
+      done[C111]    = true;
+    } else if (isCoarser(maxWidth, C)) {
+      needToFillFrom[C111] = C;
+      for (int cID = 1; cID < 8; cID++) {
+        if (isCoarser(D.actualWidth[cID], needToFillFrom[C111])) {
+          needToFillFrom[C111].pos   = neighborPos(O, C, cID);
+          needToFillFrom[C111].width = D.actualWidth[cID];
+        }
+      }
+      done[C111] = false;
+    } else {
+      O.value[C111] = fillVertex();
+      done[C111]    = true;
+    }
+  }
+
+  //! position of corner ii of O, see doOctant()
+  vec3f cornerPos(const Octant &O, int ii) const
+  {
+    const vec3f vtxPos = vec3f((ii & 1) ? O.vertex.x : O.center.x,
+                               (ii & 2) ? O.vertex.y : O.center.y,
+                               (ii & 4) ? O.vertex.z : O.center.z);
+    return vtxPos * (vec3f(1.f) / gridWorldSpace) * gridWorldSpace;
+  }
+
+  T doOctant(const CellRef &C, const vec3f &P, Octant &O, DualCell &D) const
+  {
+    findDualAndInitOctant(O, D, P, C);
+
+    // corners on our side of a boundary are filled from the dual cells of
+    // our level
+    auto boundary = [&](int corner) {
+      return coarseBoundaryValue(
+          vec3f((corner & 1) ? O.vertex.x : O.center.x,
+                (corner & 2) ? O.vertex.y : O.center.y,
+                (corner & 4) ? O.vertex.z : O.center.z),
+          C.width);
+    };
+
+    bool done[8];
+    CellRef needToFillFrom[8];
+    fillOctantCorners(C,
+                      O,
+                      D,
+                      done,
+                      needToFillFrom,
+                      boundary,
+                      boundary,
+                      [&]() { return boundary(C111); });
+
+    for (int ii = 0; ii < 8; ii++) {
+      if (done[ii])
+        continue;
+      const CellRef fillFrom = findLeafCell(needToFillFrom[ii].pos);
+      if (!fillsFromCoarser(fillFrom, C)) {
+        O.value[ii] = coarseBoundaryValue(cornerPos(O, ii), C.width);
+        continue;
+      }
+      Octant O2;
+      DualCell D2;
+      O.value[ii] = doOctant(fillFrom, cornerPos(O, ii), O2, D2);
+    }
+
+    return lerp(O.value, O.weights);
+  }
+
+  static VertexTopo vtxTopo(uint8_t idx1, uint8_t idx2)
+  {
+    switch (idx1 ^ idx2) {
+    case 0:
+      return IDENTIFY;
+    case 1:
+    case 2:
+    case 4:
+      return EDGE;
+    case 3:
+    case 5:
+    case 6:
+      return FACEDIAG;
+    default:
+      return DIAG;
+    }
+  }
+
+  static uint8_t modIdx(uint8_t a, uint8_t b)
+  {
+    return (a < b) ? a : a - b;
+  }
+
+  //! side of a face, stitched from the finer neighbor's octant
+  T stitchCoarserSide(const CellRef &C, const Octant &O, int side) const
+  {
+    vec3f P1;
+    P1.x = O.center.x + ((side & 1) ? 0.5f + delta : delta) * C.width * O.signs.x;
+    P1.y = O.center.y + ((side & 2) ? 0.5f + delta : delta) * C.width * O.signs.y;
+    P1.z = O.center.z + ((side & 4) ? 0.5f + delta : delta) * C.width * O.signs.z;
+
+    const CellRef cell = findLeafCell(P1);
+    Octant O1;
+    DualCell D1;
+    findDualAndInitOctant(O1, D1, P1, cell);
+
+    // the four corners of the neighbor's octant facing us
+    T value = O.value[C000] / 3.f;
+    for (int i = 0; i < 8; i++) {
+      if (!(i & side))
+        value += D1.value[i] / 6.f;
+    }
+    return value;
+  }
+
+  //! see stitchCoarserEdge() in octant_stitch.ih
+  T stitchCoarserEdge(const CellRef &C,
+                      const Octant &O,
+                      const DualCell &D,
+                      int cornerIdx) const
+  {
+    int numFinerNeighbors = 0;
+    T ctrlPntsValue[4];
+    bool isFiner[4]       = {false, false, false, false};
+    float weights[4]      = {0.f, 0.f, 0.f, 0.f};
+    int lastFinerNeighbor = -1;
+
+    int cpIdx[4] = {C000, C000, C000, C000};
+    switch (cornerIdx) {
+    case C011:
+      cpIdx[1] = C001;
+      cpIdx[2] = C010;
+      cpIdx[3] = C011;
+      break;
+    case C101:
+      cpIdx[1] = C001;
+      cpIdx[2] = C100;
+      cpIdx[3] = C101;
+      break;
+    case C110:
+      cpIdx[1] = C010;
+      cpIdx[2] = C100;
+      cpIdx[3] = C110;
+      break;
+    }
+
+    for (int i = 0; i < 4; i++) {
+      ctrlPntsValue[i] = D.value[cpIdx[i]];
+      if (D.actualWidth[cpIdx[i]] < D.width) {
+        numFinerNeighbors++;
+        isFiner[i]        = true;
+        lastFinerNeighbor = i;
+      }
+    }
+
+    const float s1 = (lastFinerNeighbor & 1) ? 1.f : -1.f;
+    const float s2 = (lastFinerNeighbor & 2) ? 1.f : -1.f;
+    vec3f deltP;
+    if (cornerIdx == C011) {
+      deltP = vec3f(O.vertex.x, O.vertex.y, O.center.z) +
+              delta * C.width * vec3f(s1 * O.signs.x, s2 * O.signs.y, O.signs.z);
+    } else if (cornerIdx == C101) {
+      deltP = vec3f(O.vertex.x, O.center.y, O.vertex.z) +
+              delta * C.width * vec3f(s1 * O.signs.x, O.signs.y, s2 * O.signs.z);
+    } else {
+      deltP = vec3f(O.center.x, O.vertex.y, O.vertex.z) +
+              delta * C.width * vec3f(O.signs.x, s1 * O.signs.y, s2 * O.signs.z);
+    }
+
+    const CellRef cell = findLeafCell(deltP);
+    Octant OP;
+    DualCell DP;
+    findDualAndInitOctant(OP, DP, deltP, cell);
+
+    // the two octant corners of DP on the edge through each finer
+    // control point, for the edge along z, y and x respectively
+    const int along = cornerIdx == C011 ? C100 : (cornerIdx == C101 ? C010 : C001);
+    const int u     = cornerIdx == C110 ? C010 : C001;
+    const int v     = cornerIdx == C011 ? C010 : C100;
+    auto edgeMid = [&](int i) { return 0.5f * (DP.value[i] + DP.value[i | along]); };
+
+    if (lastFinerNeighbor == 1) {
+      if (isFiner[1])
+        ctrlPntsValue[1] = edgeMid(C000);
+    } else if (lastFinerNeighbor == 2) {
+      if (isFiner[1])
+        ctrlPntsValue[1] = edgeMid(u | v);
+      if (isFiner[2])
+        ctrlPntsValue[2] = edgeMid(C000);
+    } else {
+      if (isFiner[1])
+        ctrlPntsValue[1] = edgeMid(v);
+      if (isFiner[2])
+        ctrlPntsValue[2] = edgeMid(u);
+      if (isFiner[3])
+        ctrlPntsValue[3] = edgeMid(C000);
+    }
+
+    if (numFinerNeighbors == 1) {
+      if (isFiner[1]) {
+        weights[0] = 3.f / 18.f;
+        weights[1] = 8.f / 18.f;
+        weights[2] = 4.f / 18.f;
+        weights[3] = 3.f / 18.f;
+      }
+      if (isFiner[2]) {
+        weights[0] = 3.f / 18.f;
+        weights[1] = 4.f / 18.f;
+        weights[2] = 8.f / 18.f;
+        weights[3] = 3.f / 18.f;
+      }
+      if (isFiner[3]) {
+        weights[0] = 4.f / 18.f;
+        weights[1] = 3.f / 18.f;
+        weights[2] = 3.f / 18.f;
+        weights[3] = 8.f / 18.f;
+      }
+    } else if (numFinerNeighbors == 2) {
+      if (isFiner[3]) {
+        weights[0] = 1.f / 6.f;
+        weights[3] = 2.f / 6.f;
+        weights[1] = isFiner[1] ? 2.f / 6.f : 1.f / 6.f;
+        weights[2] = isFiner[2] ? 2.f / 6.f : 1.f / 6.f;
+      } else {
+        weights[0] = 1.f / 10.f;
+        weights[1] = 4.f / 10.f;
+        weights[2] = 4.f / 10.f;
+        weights[3] = 1.f / 10.f;
+      }
+    } else {
+      weights[0] = 1.f / 9.f;
+      weights[1] = 3.f / 9.f;
+      weights[2] = 3.f / 9.f;
+      weights[3] = 2.f / 9.f;
+    }
+
+    T wSum = T(0);
+    for (int i = 0; i < 4; i++)
+      wSum += weights[i] * ctrlPntsValue[i];
+    return wSum;
+  }
+
+  //! weights of stitchCoarserVertex(), see octant_stitch.ih
+  static void coarserVertexWeights(const uint8_t *finerPntIdx,
+                                   uint8_t numFinerNeighbors,
+                                   const uint8_t *coarsePntIdx,
+                                   uint8_t numCoarseCtrlPnt,
+                                   float *weights)
+  {
+    if (numFinerNeighbors == 1) {
+      for (uint8_t i = 0; i < 8; i++) {
+        switch (vtxTopo(finerPntIdx[0], i)) {
+        case IDENTIFY:
+          weights[i] = 8.f / 27.f;
+          break;
+        case EDGE:
+          weights[i] = 1.f / 12.f;
+          break;
+        case FACEDIAG:
+          weights[i] = 1.f / 9.f;
+          break;
+        case DIAG:
+          weights[i] = 13.f / 108.f;
+          break;
+        }
+      }
+    }
+
+    if (numFinerNeighbors == 2) {
+      const VertexTopo octVtxTopo = vtxTopo(finerPntIdx[0], finerPntIdx[1]);
+      const uint8_t f0 = finerPntIdx[0], f1 = finerPntIdx[1];
+      for (uint8_t i = 0; i < 8; i++) {
+        const bool finer  = i == f0 || i == f1;
+        const bool diag   = vtxTopo(f0, i) == DIAG || vtxTopo(f1, i) == DIAG;
+        if (octVtxTopo == EDGE)
+          weights[i] = finer ? 2.f / 9.f : (diag ? 1.f / 9.f : 1.f / 12.f);
+        if (octVtxTopo == FACEDIAG)
+          weights[i] = finer ? 4.f / 15.f
+                             : diag ? 1.f / 12.f
+                                    : vtxTopo(f0, i) == EDGE ? 1.f / 20.f
+                                                            : 1.f / 10.f;
+        if (octVtxTopo == DIAG)
+          weights[i] = finer ? 2.f / 7.f : 1.f / 14.f;
+      }
+    }
+
+    if (numFinerNeighbors == 3) {
+      uint8_t edgeNum            = 0;
+      uint8_t vtxInEdgeCount[3] = {0, 0, 0};
+      for (uint8_t i = 0; i < numFinerNeighbors; i++) {
+        const uint8_t nextIdx = modIdx(i + 1, numFinerNeighbors);
+        if (vtxTopo(finerPntIdx[i], finerPntIdx[nextIdx]) == EDGE) {
+          vtxInEdgeCount[i]++;
+          vtxInEdgeCount[nextIdx]++;
+          edgeNum++;
+        }
+      }
+      const uint8_t symEdgeIdx =
+          finerPntIdx[0] ^ finerPntIdx[1] ^ finerPntIdx[2];
+
+      if (edgeNum == 2) {
+        const uint8_t shared =
+            (vtxInEdgeCount[0] == 2) ? 0 : ((vtxInEdgeCount[1] == 2) ? 1 : 2);
+        for (uint8_t i = 0; i < 8; i++) {
+          if (i == finerPntIdx[shared])
+            weights[i] = 4.f / 27.f;
+          else if (i == finerPntIdx[modIdx(shared + 1, numFinerNeighbors)] ||
+                   i == finerPntIdx[modIdx(shared + 2, numFinerNeighbors)])
+            weights[i] = 2.f / 9.f;
+          else if (vtxTopo(finerPntIdx[shared], i) == DIAG)
+            weights[i] = 11.f / 108.f;
+          else if (i == symEdgeIdx)
+            weights[i] = 1.f / 18.f;
+          else
+            weights[i] = 1.f / 12.f;
+        }
+      }
+
+      if (edgeNum == 1) {
+        const uint8_t off =
+            (vtxInEdgeCount[0] == 0) ? 0 : ((vtxInEdgeCount[1] == 0) ? 1 : 2);
+        for (uint8_t i = 0; i < 8; i++) {
+          if (i == finerPntIdx[off])
+            weights[i] = 4.f / 15.f;
+          else if (vtxTopo(finerPntIdx[off], i) == DIAG)
+            weights[i] = 2.f / 9.f;
+          else if (i == symEdgeIdx)
+            weights[i] = 2.f / 27.f;
+          else if (vtxTopo(symEdgeIdx, i) == DIAG)
+            weights[i] = 26.f / 135.f;
+          else if (vtxTopo(finerPntIdx[off], i) == EDGE)
+            weights[i] = 1.f / 20.f;
+          else
+            weights[i] = 13.f / 180.f;
+        }
+      }
+
+      if (edgeNum == 0) {
+        const uint8_t farVerticalIdx = symEdgeIdx;
+        for (uint8_t i = 0; i < 8; i++) {
+          if (i == finerPntIdx[0] || i == finerPntIdx[1] || i == finerPntIdx[2])
+            weights[i] = 8.f / 33.f;
+          else if (i == farVerticalIdx)
+            weights[i] = 1.f / 11.f;
+          else if (vtxTopo(farVerticalIdx, i) == DIAG)
+            weights[i] = 1.f / 44.f;
+          else
+            weights[i] = 7.f / 132.f;
+        }
+      }
+    }
+
+    if (numFinerNeighbors == 4) {
+      uint8_t edgeNum                 = 0;
+      uint8_t faceDiagNum             = 0;
+      uint8_t vtxSharedByEdgeCount[4] = {0, 0, 0, 0};
+      for (uint8_t i = 0; i < numFinerNeighbors; i++) {
+        for (uint8_t j = i + 1; j < numFinerNeighbors; j++) {
+          const uint8_t nextIdx = modIdx(j, numFinerNeighbors);
+          if (vtxTopo(finerPntIdx[i], finerPntIdx[nextIdx]) == EDGE) {
+            vtxSharedByEdgeCount[i]++;
+            vtxSharedByEdgeCount[nextIdx]++;
+            edgeNum++;
+          }
+          if (vtxTopo(finerPntIdx[i], finerPntIdx[nextIdx]) == FACEDIAG)
+            faceDiagNum++;
+        }
+      }
+      auto isFiner = [&](uint8_t i) {
+        return i == finerPntIdx[0] || i == finerPntIdx[1] ||
+               i == finerPntIdx[2] || i == finerPntIdx[3];
+      };
+
+      if (edgeNum == 4) {
+        for (uint8_t i = 0; i < 8; i++)
+          weights[i] = isFiner(i) ? 1.f / 6.f : 1.f / 12.f;
+      }
+
+      if (edgeNum == 2 && faceDiagNum == 2) {
+        for (uint8_t i = 0; i < 8; i++)
+          weights[i] = isFiner(i) ? 1.f / 5.f : 1.f / 20.f;
+      }
+
+      if (faceDiagNum == 6) {
+        for (uint8_t i = 0; i < 8; i++)
+          weights[i] = isFiner(i) ? 2.f / 9.f : 1.f / 36.f;
+      }
+
+      if (edgeNum == 3 && faceDiagNum == 2) {
+        uint8_t by1[2] = {0, 0}, by2[2] = {0, 0};
+        uint8_t n1 = 0, n2 = 0;
+        for (uint8_t i = 0; i < numFinerNeighbors; i++) {
+          if (vtxSharedByEdgeCount[i] == 1)
+            by1[n1++] = finerPntIdx[i];
+          if (vtxSharedByEdgeCount[i] == 2)
+            by2[n2++] = finerPntIdx[i];
+        }
+        for (uint8_t i = 0; i < 8; i++) {
+          if (i == by1[0] || i == by1[1])
+            weights[i] = 2.f / 9.f;
+          else if (i == by2[0] || i == by2[1])
+            weights[i] = 4.f / 27.f;
+          else if (vtxTopo(i, by2[0]) == DIAG || vtxTopo(i, by2[1]) == DIAG)
+            weights[i] = 2.f / 27.f;
+          else
+            weights[i] = 1.f / 18.f;
+        }
+      }
+
+      if (edgeNum == 3 && faceDiagNum == 3) {
+        uint8_t by1[3] = {0, 0, 0}, by3 = 0;
+        uint8_t n1 = 0;
+        for (uint8_t i = 0; i < numFinerNeighbors; i++) {
+          if (vtxSharedByEdgeCount[i] == 1)
+            by1[n1++] = finerPntIdx[i];
+          if (vtxSharedByEdgeCount[i] == 3)
+            by3 = finerPntIdx[i];
+        }
+        for (uint8_t i = 0; i < 8; i++) {
+          if (i == by3)
+            weights[i] = 2.f / 27.f;
+          else if (i == by1[0] || i == by1[1] || i == by1[2])
+            weights[i] = 2.f / 9.f;
+          else if (vtxTopo(i, by3) == DIAG)
+            weights[i] = 5.f / 54.f;
+          else
+            weights[i] = 1.f / 18.f;
+        }
+      }
+
+      if (edgeNum == 2 && faceDiagNum == 3) {
+        uint8_t by0 = 0, by1[2] = {0, 0};
+        uint8_t n1 = 0;
+        for (uint8_t i = 0; i < numFinerNeighbors; i++) {
+          if (vtxSharedByEdgeCount[i] == 0)
+            by0 = finerPntIdx[i];
+          if (vtxSharedByEdgeCount[i] == 1)
+            by1[n1++] = finerPntIdx[i];
+        }
+        for (uint8_t i = 0; i < 8; i++) {
+          if (i == by0)
+            weights[i] = 22.f / 89.f;
+          else if (i == by1[0] || i == by1[1])
+            weights[i] = 52.f / 267.f;
+          else if (vtxTopo(i, by1[0]) == DIAG || vtxTopo(i, by1[1]) == DIAG)
+            weights[i] = 14.f / 267.f;
+          else if (vtxTopo(i, by0) == EDGE)
+            weights[i] = 5.f / 178.f;
+          else
+            weights[i] = 13.f / 178.f;
+        }
+      }
+    }
+
+    if (numFinerNeighbors == 5) {
+      uint8_t coarseEdgeNum      = 0;
+      uint8_t vtxSharedByEdge[3] = {0, 0, 0};
+      for (uint8_t i = 0; i < numCoarseCtrlPnt; i++) {
+        const uint8_t nextIdx = modIdx(i + 1, numCoarseCtrlPnt);
+        if (vtxTopo(coarsePntIdx[i], coarsePntIdx[nextIdx]) == EDGE) {
+          vtxSharedByEdge[i]++;
+          vtxSharedByEdge[nextIdx]++;
+          coarseEdgeNum++;
+        }
+      }
+      const uint8_t symEdgePnt =
+          coarsePntIdx[0] ^ coarsePntIdx[1] ^ coarsePntIdx[2];
+
+      if (coarseEdgeNum == 2) {
+        const uint8_t shared =
+            (vtxSharedByEdge[0] == 2) ? 0 : ((vtxSharedByEdge[1] == 2) ? 1 : 2);
+        for (uint8_t i = 0; i < 8; i++) {
+          if (i == coarsePntIdx[shared])
+            weights[i] = 2.f / 27.f;
+          else if (i == coarsePntIdx[modIdx(shared + 1, numCoarseCtrlPnt)] ||
+                   i == coarsePntIdx[modIdx(shared + 2, numCoarseCtrlPnt)])
+            weights[i] = 1.f / 18.f;
+          else if (i == symEdgePnt)
+            weights[i] = 2.f / 9.f;
+          else if (vtxTopo(coarsePntIdx[shared], i) == DIAG)
+            weights[i] = 5.f / 54.f;
+          else
+            weights[i] = 1.f / 6.f;
+        }
+      }
+
+      if (coarseEdgeNum == 1) {
+        const uint8_t off =
+            (vtxSharedByEdge[0] == 0) ? 0 : ((vtxSharedByEdge[1] == 0) ? 1 : 2);
+        for (uint8_t i = 0; i < 8; i++) {
+          if (i == coarsePntIdx[off])
+            weights[i] = 1.f / 30.f;
+          else if (vtxTopo(coarsePntIdx[off], i) == DIAG)
+            weights[i] = 1.f / 18.f;
+          else if (i == symEdgePnt)
+            weights[i] = 4.f / 27.f;
+          else if (vtxTopo(symEdgePnt, i) == DIAG)
+            weights[i] = 7.f / 135.f;
+          else if (vtxTopo(coarsePntIdx[off], i) == EDGE)
+            weights[i] = 1.f / 5.f;
+          else
+            weights[i] = 7.f / 45.f;
+        }
+      }
+
+      if (coarseEdgeNum == 0) {
+        const uint8_t farVerticalPnt = symEdgePnt;
+        for (uint8_t i = 0; i < 8; i++) {
+          if (i == coarsePntIdx[0] || i == coarsePntIdx[1] ||
+              i == coarsePntIdx[2])
+            weights[i] = 1.f / 33.f;
+          else if (i == farVerticalPnt)
+            weights[i] = 1.f / 11.f;
+          else if (vtxTopo(farVerticalPnt, i) == DIAG)
+            weights[i] = 5.f / 22.f;
+          else
+            weights[i] = 13.f / 66.f;
+        }
+      }
+    }
+
+    if (numFinerNeighbors == 6) {
+      const VertexTopo coarseVtxTopo = vtxTopo(coarsePntIdx[0], coarsePntIdx[1]);
+      const uint8_t c0 = coarsePntIdx[0], c1 = coarsePntIdx[1];
+      for (uint8_t i = 0; i < 8; i++) {
+        const bool coarse = i == c0 || i == c1;
+        const bool diag   = vtxTopo(c0, i) == DIAG || vtxTopo(c1, i) == DIAG;
+        if (coarseVtxTopo == EDGE)
+          weights[i] = coarse ? 1.f / 18.f : (diag ? 1.f / 9.f : 1.f / 6.f);
+        if (coarseVtxTopo == FACEDIAG)
+          weights[i] = coarse ? 1.f / 30.f
+                              : diag ? 1.f / 6.f
+                                     : vtxTopo(c0, i) == EDGE ? 1.f / 5.f
+                                                             : 1.f / 10.f;
+        if (coarseVtxTopo == DIAG)
+          weights[i] = coarse ? 1.f / 26.f : 2.f / 13.f;
+      }
+    }
+
+    if (numFinerNeighbors == 7) {
+      for (uint8_t i = 0; i < 8; i++) {
+        switch (vtxTopo(coarsePntIdx[0], i)) {
+        case IDENTIFY:
+          weights[i] = 1.f / 27.f;
+          break;
+        case EDGE:
+          weights[i] = 1.f / 6.f;
+          break;
+        case FACEDIAG:
+          weights[i] = 1.f / 9.f;
+          break;
+        case DIAG:
+          weights[i] = 7.f / 54.f;
+          break;
+        }
+      }
+    }
+  }
+
+  //! see stitchCoarserVertex() in octant_stitch.ih
+  T stitchCoarserVertex(const CellRef &C, const Octant &O, const DualCell &D) const
+  {
+    T ctrlPntsValue[8];
+    float weights[8]          = {0, 0, 0, 0, 0, 0, 0, 0};
+    uint8_t numFinerNeighbors = 0;
+    uint8_t finerPntIdx[8];
+    uint8_t numCoarseCtrlPnt = 0;
+    uint8_t coarsePntIdx[8];
+
+    for (uint8_t i = 0; i < 8; i++) {
+      ctrlPntsValue[i] = D.value[i];
+      if (D.actualWidth[i] < D.width)
+        finerPntIdx[numFinerNeighbors++] = i;
+      else
+        coarsePntIdx[numCoarseCtrlPnt++] = i;
+    }
+
+    // no finer neighbor matches none of the weight patterns
+    if (numFinerNeighbors == 0)
+      return T(0);
+
+    const uint8_t lastFiner = finerPntIdx[numFinerNeighbors - 1];
+
+    const vec3f deltP =
+        O.vertex + delta * C.width *
+                       vec3f(((lastFiner & 1) ? 1.f : -1.f) * O.signs.x,
+                             ((lastFiner & 2) ? 1.f : -1.f) * O.signs.y,
+                             ((lastFiner & 4) ? 1.f : -1.f) * O.signs.z);
+
+    const CellRef cell = findLeafCell(deltP);
+    Octant OP;
+    DualCell DP;
+    findDualAndInitOctant(OP, DP, deltP, cell);
+
+    // the finer points in the octant coordinates of the finer cell
+    for (uint8_t i = 0; i < numFinerNeighbors; i++)
+      ctrlPntsValue[finerPntIdx[i]] = DP.value[lastFiner ^ finerPntIdx[i]];
+
+    coarserVertexWeights(
+        finerPntIdx, numFinerNeighbors, coarsePntIdx, numCoarseCtrlPnt, weights);
+
+    T wSum = T(0);
+    for (int i = 0; i < 8; i++)
+      wSum += weights[i] * ctrlPntsValue[i];
+    return wSum;
+  }
+
+  T doTrilinear(const CellRef &C, const vec3f &P, Octant &O, DualCell &D) const
+  {
+    findDualAndInitOctant(O, D, P, C);
+
+    bool done[8];
+    CellRef needToFillFrom[8];
+    fillOctantCorners(
+        C,
+        O,
+        D,
+        done,
+        needToFillFrom,
+        [&](int side) { return stitchCoarserSide(C, O, side); },
+        [&](int edge) { return stitchCoarserEdge(C, O, D, edge); },
+        [&]() { return stitchCoarserVertex(C, O, D); });
+
+    for (int ii = 0; ii < 8; ii++) {
+      if (done[ii])
+        continue;
+      const CellRef fillFrom = findLeafCell(needToFillFrom[ii].pos);
+      if (!fillsFromCoarser(fillFrom, C)) {
+        O.value[ii] = coarseBoundaryValue(cornerPos(O, ii), C.width);
+        continue;
+      }
+      Octant O2;
+      DualCell D2;
+      O.value[ii] = doTrilinear(fillFrom, cornerPos(O, ii), O2, D2);
+    }
+
+    return lerp(O.value, O.weights);
+  }
+
+  const VoxelOctreeNode *nodes;
+  size_t numNodes;
+  box3f actualBounds;
+  box3f virtualBounds;
+  vec3f worldOrigin;
+  vec3f gridOrigin;
+  vec3f gridWorldSpace;
+};
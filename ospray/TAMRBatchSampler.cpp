@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "TAMRBatchSampler.h"
+#include "TAMRBatchSampler_ispc.h"
+#include "TAMRVolume.h"
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+
+TAMRBatchSampler::TAMRBatchSampler(TAMRVolume *volume, Filter filter)
+    : volume(volume), filter(filter)
+{
+  if (!volume)
+    throw std::runtime_error("TAMRBatchSampler error: no volume given!");
+}
+
+TAMRBatchSampler::TAMRBatchSampler(TAMRVolume *volume,
+                                   const std::string &filterMethod)
+    : TAMRBatchSampler(volume, filterFromString(filterMethod))
+{
+}
+
+TAMRBatchSampler::Filter TAMRBatchSampler::filterFromString(
+    const std::string &filterMethod)
+{
+  if (filterMethod == "nearest")
+    return NEAREST;
+  if (filterMethod == "current")
+    return CURRENT;
+  if (filterMethod == "finest")
+    return FINEST;
+  if (filterMethod == "octant")
+    return OCTANT;
+  if (filterMethod == "trilinear")
+    return TRILINEAR;
+  throw std::runtime_error("TAMRBatchSampler error: unknown filter method '" +
+                           filterMethod + "'!");
+}
+
+template <typename F>
+void TAMRBatchSampler::forEachTile(size_t numPoints, const F &f) const
+{
+  const size_t tile = std::max<size_t>(1, tileSize);
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, numPoints, tile),
+                    [&](const tbb::blocked_range<size_t> &r) {
+                      // the ISPC side indexes with 32 bit ints
+                      for (size_t begin = r.begin(); begin < r.end();
+                           begin += tile) {
+                        f(begin, std::min(r.end(), begin + tile));
+                      }
+                    });
+}
+
+void TAMRBatchSampler::sample(const vec3f *positions,
+                              float *values,
+                              size_t numPoints,
+                              bool coherent) const
+{
+  void *ie = volume->getIE();
+  forEachTile(numPoints, [&](size_t begin, size_t end) {
+    ispc::TAMR_sampleBatch(ie,
+                           filter,
+                           (const ispc::vec3f *)(positions + begin),
+                           values + begin,
+                           int(end - begin),
+                           coherent);
+  });
+}
+
+void TAMRBatchSampler::sample(const float *x,
+                              const float *y,
+                              const float *z,
+                              float *values,
+                              size_t numPoints,
+                              bool coherent) const
+{
+  void *ie = volume->getIE();
+  forEachTile(numPoints, [&](size_t begin, size_t end) {
+    ispc::TAMR_sampleBatchSoA(ie,
+                              filter,
+                              x + begin,
+                              y + begin,
+                              z + begin,
+                              values + begin,
+                              int(end - begin),
+                              coherent);
+  });
+}
+
+void TAMRBatchSampler::sampleAndGradient(const float *x,
+                                         const float *y,
+                                         const float *z,
+                                         float *values,
+                                         float *gx,
+                                         float *gy,
+                                         float *gz,
+                                         size_t numPoints) const
+{
+  void *ie = volume->getIE();
+  forEachTile(numPoints, [&](size_t begin, size_t end) {
+    ispc::TAMR_sampleGradientBatchSoA(ie,
+                                      filter,
+                                      x + begin,
+                                      y + begin,
+                                      z + begin,
+                                      values + begin,
+                                      gx + begin,
+                                      gy + begin,
+                                      gz + begin,
+                                      int(end - begin));
+  });
+}
+
+std::vector<float> TAMRBatchSampler::sample(
+    const std::vector<vec3f> &positions, bool coherent) const
+{
+  std::vector<float> values(positions.size());
+  sample(positions.data(), values.data(), positions.size(), coherent);
+  return values;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "ospcommon/math/vec.h"
+
+using namespace ospcommon;
+using namespace ospcommon::math;
+
+class TAMRVolume;
+
+/*! host-side sampling of a committed TAMRVolume at arrays of world space
+ * positions, with any of the volume's reconstruction filters. The points
+ * are split into tiles that are sampled in parallel, each tile in SIMD
+ * packets by the ISPC filter code the renderer uses.
+ */
+class TAMRBatchSampler
+{
+ public:
+  //! must match TAMR_Filter in TAMRBatchSampler.ispc
+  enum Filter
+  {
+    NEAREST = 0,
+    CURRENT,
+    FINEST,
+    OCTANT,
+    TRILINEAR
+  };
+
+  TAMRBatchSampler(TAMRVolume *volume, Filter filter = NEAREST);
+  TAMRBatchSampler(TAMRVolume *volume, const std::string &filterMethod);
+
+  /*! 'coherent' marks consecutive points as close to each other (probe
+   * lines, particle paths), which lets every lane start its lookup from
+   * the leaf of its previous point */
+  void sample(const vec3f *positions,
+              float *values,
+              size_t numPoints,
+              bool coherent = false) const;
+
+  std::vector<float> sample(const std::vector<vec3f> &positions,
+                            bool coherent = false) const;
+
+  //! the same for positions in SoA form
+  void sample(const float *x,
+              const float *y,
+              const float *z,
+              float *values,
+              size_t numPoints,
+              bool coherent = false) const;
+
+  //! samples and their world space gradients, positions in SoA form
+  void sampleAndGradient(const float *x,
+                         const float *y,
+                         const float *z,
+                         float *values,
+                         float *gx,
+                         float *gy,
+                         float *gz,
+                         size_t numPoints) const;
+
+  //! parse the names used by OSPRAY_TAMR_METHOD / amrMethod
+  static Filter filterFromString(const std::string &filterMethod);
+
+  //! points per parallel task
+  size_t tileSize{4096};
+
+ private:
+  //! call f(begin, end) for tiles of at most tileSize points in parallel
+  template <typename F>
+  void forEachTile(size_t numPoints, const F &f) const;
+
+  TAMRVolume *volume;
+  Filter filter;
+};
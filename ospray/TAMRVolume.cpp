@@ -2,6 +2,7 @@
 #include <stdexcept>
 #include "ospcommon/math/vec.h"
 #include "ospcommon/math/box.h"
+#include "ospcommon/tasking/parallel_for.h"
 
 // Our exported ISPC functions are in this _ispc.h
 #include "TAMRVolume_ispc.h"
@@ -11,6 +12,15 @@
 #include "filter_finest_ispc.h"
 #include "filter_octant_ispc.h"
 #include "filter_trilinear_ispc.h"
+#include "TAMRBenchmark_ispc.h"
+#include "OctreeReconstruction.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <random>
 
 using namespace ospcommon;
 using namespace ospcommon::math;
@@ -21,19 +31,27 @@ extern "C" void ispc_called_cpp_function_example(int val) {
   std::cout << "Called from ISPC, val: " << val << "\n";
 }
 
-/*! callback function called by ispc sampling code to compute a
-  gradient at given sample pos in this (c++-only) module */
-extern "C" float P4est_scalar_sample(ScalarVolumeSampler *cppSampler, const vec3f *samplePos)
-{
-  return cppSampler->sample(*samplePos);
-}
-
+// Scratch memory of TAMRVolume_stepRay() (StepRayState in TAMRVolume.ispc),
+// one block per render thread. It only has to survive from one call for a
+// ray to the next, which happen on the same thread.
+extern "C" void *TAMR_stepRayState(int64_t bytes) {
+  struct Block
+  {
+    void *data{nullptr};
+    int64_t bytes{0};
+    ~Block() { std::free(data); }
+  };
+  static thread_local Block block;
 
-/*! callback function called by ispc sampling code to compute a
-  sample in this (c++-only) module */
-extern "C" vec3f P4est_scalar_computeGradient(ScalarVolumeSampler *cppSampler, const vec3f *samplePos)
-{
-  return cppSampler->computeGradient(*samplePos);
+  if (block.bytes < bytes) {
+    std::free(block.data);
+    const int64_t aligned = (bytes + 63) / 64 * 64;
+    block.data  = std::aligned_alloc(64, aligned);
+    block.bytes = bytes;
+    // a zeroed block matches no volume, the state starts out empty
+    std::memset(block.data, 0, aligned);
+  }
+  return block.data;
 }
 
 TAMRVolume::TAMRVolume() {
@@ -42,6 +60,9 @@ TAMRVolume::TAMRVolume() {
 }
 
 TAMRVolume::~TAMRVolume() {
+  if (prefetch.valid())
+    prefetch.wait();
+  reportValueCache();
   ispc::TAMRVolume_freeVolume(ispcEquivalent);
   delete sampler;
 
@@ -54,14 +75,14 @@ std::string TAMRVolume::toString() const {
 }
 
 
-ScalarVolumeSampler* TAMRVolume::createSampler(){
+PacketVolumeSampler* TAMRVolume::createSampler(){
   return new TAMRVolumeSampler(this);
 }
 
 void TAMRVolume::commit() {
   Volume::commit();
 
-  vec3f worldOrigin = getParam3f("worldOrigin", vec3f(0.f)); 
+  this->worldOrigin = getParam3f("worldOrigin", vec3f(0.f));
   // Set the grid origin, default to (0,0,0).
   this->gridOrigin = getParam3f("gridOrigin", vec3f(0.f));
   // Set the grid spacing, default to (1,1,1).
@@ -73,48 +94,540 @@ void TAMRVolume::commit() {
 
 
   _voxelAccel = (VoxelOctree*)getParamVoidPtr("voxelOctree",nullptr);
-  if (!_voxelAccel) {
+  timeSeries  = (TimeSeriesOctree *)getParamVoidPtr("timeSeries", nullptr);
+  if (!_voxelAccel && !timeSeries) {
     throw std::runtime_error("TAMRVolume error: the voxelOctree must be set!");
   }
 
-  bounds = _voxelAccel->_actualBounds;
+  // a time series brings its own topology, the nodes change per timestep
+  VoxelOctree *octree = timeSeries ? &timeSeries->topology : _voxelAccel;
+  const std::vector<VoxelOctreeNode> &octreeNodes =
+      timeSeries ? selectTimestep(getParam1i("timestep", 0))
+                 : _voxelAccel->_octreeNodes;
+
+  bounds = octree->_actualBounds;
 
   bounds.lower = worldOrigin + (bounds.lower - gridOrigin) * gridWorldSpace;
   bounds.upper = worldOrigin + (bounds.upper - gridOrigin) * gridWorldSpace;
 
   // Pass the various parameters over to the ISPC side of the code
   ispc::TAMRVolume_set(getIE(),
-                        (ispc::box3f*)&_voxelAccel->_actualBounds,
+                        (ispc::box3f*)&octree->_actualBounds,
                         (ispc::vec3i &)this->dimensions,
                         (ispc::vec3f &)this->gridOrigin,
                         (ispc::vec3f &)this->gridWorldSpace,
                         (ispc::vec3f &)worldOrigin,
                         samplesPerCell,
                         opacityScaleFactor,
-                        this,
-                        sampler);
+                        this);
 
   auto filterMethodEnv = utility::getEnvVar<std::string>("OSPRAY_TAMR_METHOD");
 
-  std::string filterMethod =
+  filterMethod =
       filterMethodEnv.value_or(getParamString("amrMethod", "nearest"));
 
+  installFilter(getIE(), filterMethod);
+  batchSampler = TAMRBatchSampler(this, filterMethod);
+
+  ispc::TAMRVolume_setVoxelOctree(getIE(),
+                                    octreeNodes.data(),
+                                    octreeNodes.size(),
+                                    (ispc::box3f*)&octree->_actualBounds,
+                                    (ispc::box3f*)&octree->_virtualBounds);
+
+  ispc::TAMRVolume_setAdaptiveSampling(getIE(),
+                                       getParam1f("samplingErrorBudget", 0.f),
+                                       getParam1f("pixelFootprint", 0.f));
+
+  updateNodeMaxOpacity(octreeNodes,
+                       timeSeries ? stepBuffers[frontBuffer].step : -1);
+  updatePreIntegration(*octree);
+
+  auto valueCacheEnv = utility::getEnvVar<int>("OSPRAY_TAMR_VALUE_CACHE");
+  auto valueCacheStatsEnv =
+      utility::getEnvVar<int>("OSPRAY_TAMR_VALUE_CACHE_STATS");
+  updateValueCache(
+      valueCacheEnv.value_or(getParam1i("valueCacheLog2Size", 0)),
+      octreeNodes.size(),
+      valueCacheStatsEnv.value_or(getParam1i("valueCacheStats", 0)) != 0);
+}
+
+void TAMRVolume::installFilter(void *ie, const std::string &filterMethod)
+{
   if (filterMethod == "nearest")
-    ispc::TAMR_install_nearest(getIE());
+    ispc::TAMR_install_nearest(ie);
   else if (filterMethod == "current")
-    ispc::TAMR_install_current(getIE());
+    ispc::TAMR_install_current(ie);
   else if (filterMethod == "finest")
-    ispc::TAMR_install_finest(getIE());
+    ispc::TAMR_install_finest(ie);
   else if (filterMethod == "octant")
-    ispc::TAMR_install_octant(getIE());
+    ispc::TAMR_install_octant(ie);
   else if (filterMethod == "trilinear")
-    ispc::TAMR_install_trilinear(getIE());
+    ispc::TAMR_install_trilinear(ie);
+}
 
-  ispc::TAMRVolume_setVoxelOctree(getIE(),
-                                    _voxelAccel->_octreeNodes.data(),
-                                    _voxelAccel->_octreeNodes.size(),
-                                    (ispc::box3f*)&_voxelAccel->_actualBounds,
-                                    (ispc::box3f*)&_voxelAccel->_virtualBounds);
+bool TAMRVolume::TransferFunctionStamp::operator==(
+    const TransferFunctionStamp &other) const
+{
+  return tfn.ptr == other.tfn.ptr && color.ptr == other.color.ptr &&
+         opacity.ptr == other.opacity.ptr && valueRange == other.valueRange;
+}
+
+TAMRVolume::TransferFunctionStamp TAMRVolume::stampOf(
+    ospray::TransferFunction *tfn)
+{
+  TransferFunctionStamp stamp;
+  stamp.tfn        = tfn;
+  stamp.color      = tfn->getParamData("color", nullptr);
+  stamp.opacity    = tfn->getParamData("opacity", nullptr);
+  stamp.valueRange = tfn->getParam2f("valueRange", vec2f(0.f, 1.f));
+  return stamp;
+}
+
+void TAMRVolume::updateNodeMaxOpacity(const std::vector<VoxelOctreeNode> &nodes,
+                                      int step)
+{
+  auto *tfn =
+      getParamObject<ospray::TransferFunction>("transferFunction", nullptr);
+  if (!tfn) {
+    nodeOpacityStamp = TransferFunctionStamp();
+    nodeOpacityNodes = nullptr;
+    std::vector<uint8_t>().swap(nodeMaxOpacity);
+    ispc::TAMRVolume_setNodeMaxOpacity(getIE(), nullptr, nullptr);
+    return;
+  }
+
+  // commits that change neither, like a new sampling rate, keep the table
+  const TransferFunctionStamp stamp = stampOf(tfn);
+  if (stamp == nodeOpacityStamp && nodes.data() == nodeOpacityNodes &&
+      nodes.size() == nodeMaxOpacity.size() && step == nodeOpacityStep)
+    return;
+  nodeOpacityStamp = stamp;
+  nodeOpacityNodes = nodes.data();
+  nodeOpacityStep  = step;
+
+  const size_t numNodes = nodes.size();
+  nodeMaxOpacity.resize(numNodes);
+  const size_t blockSize = 1 << 16;
+  const size_t numBlocks = (numNodes + blockSize - 1) / blockSize;
+  tasking::parallel_for(numBlocks, [&](size_t b) {
+    const size_t begin = b * blockSize;
+    ispc::TAMRVolume_computeNodeMaxOpacity(
+        getIE(),
+        tfn->getIE(),
+        nodeMaxOpacity.data(),
+        begin,
+        int(std::min(blockSize, numNodes - begin)));
+  });
+
+  ispc::TAMRVolume_setNodeMaxOpacity(
+      getIE(), nodeMaxOpacity.data(), tfn->getIE());
+}
+
+void TAMRVolume::updatePreIntegration(const VoxelOctree &octree)
+{
+  auto preIntegrationEnv = utility::getEnvVar<int>("OSPRAY_TAMR_PREINTEGRATION");
+  const bool enabled =
+      preIntegrationEnv.value_or(getParam1i("preIntegration", 0)) != 0;
+
+  auto *tfn =
+      getParamObject<ospray::TransferFunction>("transferFunction", nullptr);
+  if (enabled && !tfn) {
+    std::cout << "#osp:tamr: pre-integration needs the 'transferFunction' "
+                 "parameter, disabled\n";
+  }
+  if (!enabled || !tfn) {
+    preIntegrationSource = PreIntegrationSource();
+    std::vector<vec4f>().swap(preIntegrationTable);
+    ispc::TAMRVolume_setPreIntegration(
+        getIE(), nullptr, 0, 0, 0.f, 0.f, 0.f, nullptr);
+    return;
+  }
+
+  // segment lengths are in grid units, where the finest cells have width
+  // 1; the longest segment crosses the whole virtual bounds
+  const int numValues        = 128;
+  const int numSteps         = 64;
+  const int lengthsPerOctave = 2;  // PREINT_LENGTHS_PER_OCTAVE
+  const float minLength      = 1.f / 16.f;
+  const float maxLength = std::sqrt(3.f) * octree._virtualBounds.size().x;
+  const int numLengths =
+      2 + int(std::ceil(lengthsPerOctave * std::log2(maxLength / minLength)));
+
+  PreIntegrationSource source;
+  source.tfn                = stampOf(tfn);
+  source.opacityScaleFactor = getParam1f("opacityScaleFactor", 1.f);
+  source.maxLength          = maxLength;
+  if (source.tfn == preIntegrationSource.tfn &&
+      source.opacityScaleFactor == preIntegrationSource.opacityScaleFactor &&
+      source.maxLength == preIntegrationSource.maxLength)
+    return;
+  preIntegrationSource = source;
+
+  const vec2f valueRange = source.tfn.valueRange;
+  preIntegrationTable.resize(size_t(numLengths) * numValues * numValues);
+  ispc::TAMRVolume_setPreIntegration(getIE(),
+                                     preIntegrationTable.data(),
+                                     numValues,
+                                     numLengths,
+                                     valueRange.x,
+                                     valueRange.y,
+                                     minLength,
+                                     tfn->getIE());
+
+  tasking::parallel_for(numLengths * numValues, [&](int row) {
+    ispc::TAMRVolume_buildPreIntegrationRow(
+        getIE(), tfn->getIE(), row / numValues, row % numValues, numSteps);
+  });
+}
+
+void TAMRVolume::updateValueCache(int log2Size, size_t numNodes, bool stats)
+{
+  reportValueCache();
+
+  if (log2Size > 0 && numNodes > DualValueCache::maxNodes) {
+    std::cout << "#osp:tamr: too many nodes for the value cache, disabled\n";
+    log2Size = 0;
+  }
+  valueCache.resize(log2Size);
+  valueCache.enableStats(stats);
+
+  // the cached values are only valid for the data and filter of one commit
+  valueCache.clear();
+  ispc::TAMRVolume_setValueCache(getIE(),
+                                 valueCache.slotData(),
+                                 valueCache.size(),
+                                 valueCache.currentEpoch(),
+                                 valueCache.statsData());
+}
+
+void TAMRVolume::reportValueCache() const
+{
+  const int64_t lookups = valueCache.lookups();
+  if (!valueCache.enabled() || !valueCache.statsEnabled() || lookups == 0)
+    return;
+
+  std::cout << "#osp:tamr: value cache, " << valueCache.size() << " slots: "
+            << lookups << " octant lookups, "
+            << 100.0 * valueCache.hits() / lookups << "% hits\n";
+}
+
+void TAMRVolume::runSamplingBenchmark(int numPoints)
+{
+  const VoxelOctree &octree = timeSeries ? timeSeries->topology : *_voxelAccel;
+
+  // the same pseudo-random points in grid and in world coordinates
+  std::mt19937 rng(0x7a3);
+  std::uniform_real_distribution<float> u(0.f, 1.f);
+  const vec3f lo   = octree._actualBounds.lower;
+  const vec3f size = octree._actualBounds.size();
+  std::vector<vec3f> localPoints(numPoints), worldPoints(numPoints);
+  for (int i = 0; i < numPoints; i++) {
+    localPoints[i] = lo + vec3f(u(rng), u(rng), u(rng)) * size;
+    worldPoints[i] = worldOrigin + (localPoints[i] - gridOrigin) * gridWorldSpace;
+  }
+
+  auto timeIt = [&](const std::function<float()> &run, float &result) {
+    auto t0 = std::chrono::steady_clock::now();
+    result  = run();
+    std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+    return numPoints / dt.count() * 1e-6;
+  };
+
+  std::cout << "#osp:tamr: sampling benchmark, " << numPoints << " points\n";
+
+  float stacked, stackless;
+  const double stackedRate = timeIt(
+      [&]() {
+        return ispc::TAMR_benchmarkLookup(
+            getIE(), (ispc::vec3f *)localPoints.data(), numPoints, false);
+      },
+      stacked);
+  const double stacklessRate = timeIt(
+      [&]() {
+        return ispc::TAMR_benchmarkLookup(
+            getIE(), (ispc::vec3f *)localPoints.data(), numPoints, true);
+      },
+      stackless);
+  std::cout << "  findLeafCell  stack: " << stackedRate
+            << " M/s  stackless: " << stacklessRate << " M/s ("
+            << stacklessRate / stackedRate << "x)\n";
+  if (stacked != stackless)
+    std::cout << "  WARNING: lookups disagree (" << stacked << " vs "
+              << stackless << ")\n";
+
+  for (const char *filter : {"nearest", "current", "trilinear", "octant"}) {
+    installFilter(getIE(), filter);
+    float sum;
+    const double rate = timeIt(
+        [&]() {
+          return ispc::TAMR_benchmarkSample(
+              getIE(), (ispc::vec3f *)worldPoints.data(), numPoints);
+        },
+        sum);
+    std::cout << "  " << filter << ": " << rate << " M samples/s\n";
+  }
+
+  // coherent sequences: rays of 64 samples a quarter cell apart
+  const int numSteps = 64;
+  const int numRays  = std::max(1, numPoints / numSteps);
+  const float stepSize = 0.25f * reduce_min(gridWorldSpace);
+  std::vector<vec3f> directions(numRays);
+  for (auto &d : directions) {
+    d = normalize(vec3f(u(rng), u(rng), u(rng)) - vec3f(0.5f));
+  }
+
+  for (const char *filter : {"nearest", "current", "trilinear", "octant"}) {
+    installFilter(getIE(), filter);
+    double rates[2];
+    float sums[2];
+    for (int hinted = 0; hinted < 2; hinted++) {
+      rates[hinted] = timeIt(
+          [&]() {
+            return ispc::TAMR_benchmarkMarch(getIE(),
+                                             (ispc::vec3f *)worldPoints.data(),
+                                             (ispc::vec3f *)directions.data(),
+                                             numRays,
+                                             numSteps,
+                                             stepSize,
+                                             hinted);
+          },
+          sums[hinted]);
+      // timeIt counts numPoints, a march takes numRays * numSteps samples
+      rates[hinted] *= double(numRays) * numSteps / numPoints;
+    }
+    std::cout << "  " << filter << " along rays  no hint: " << rates[0]
+              << " M/s  leaf hint: " << rates[1] << " M/s ("
+              << rates[1] / rates[0] << "x)\n";
+    if (sums[0] != sums[1])
+      std::cout << "  WARNING: hinted samples disagree (" << sums[0] << " vs "
+                << sums[1] << ")\n";
+  }
+
+  installFilter(getIE(), filterMethod);
+}
+
+int TAMRVolume::checkFilters(int numPoints)
+{
+  const VoxelOctree &octree = timeSeries ? timeSeries->topology : *_voxelAccel;
+  const std::vector<VoxelOctreeNode> &octreeNodes =
+      timeSeries ? stepBuffers[frontBuffer].nodes : _voxelAccel->_octreeNodes;
+
+  std::mt19937 rng(0x7a3);
+  std::uniform_real_distribution<float> u(0.f, 1.f);
+  const vec3f lo   = bounds.lower;
+  const vec3f size = bounds.size();
+  std::vector<vec3f> worldPoints(numPoints);
+  for (auto &p : worldPoints)
+    p = lo + vec3f(u(rng), u(rng), u(rng)) * size;
+
+  typedef OctreeReconstruction<float> Reference;
+  const Reference reference(octree,
+                            octreeNodes.data(),
+                            octreeNodes.size(),
+                            worldOrigin,
+                            gridOrigin,
+                            gridWorldSpace);
+
+  auto timeIt = [&](const std::function<void()> &run) {
+    auto t0 = std::chrono::steady_clock::now();
+    run();
+    std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+    return numPoints / dt.count() * 1e-6;
+  };
+
+  // the kernels round rcp() differently, allow for that
+  auto countMismatches = [](const std::vector<float> &values,
+                            const std::vector<float> &expected) {
+    int mismatches = 0;
+    for (size_t i = 0; i < values.size(); i++) {
+      if (std::abs(values[i] - expected[i]) >
+          1e-4f * std::max(1.f, std::abs(expected[i])))
+        mismatches++;
+    }
+    return mismatches;
+  };
+  int failures = 0;
+
+  // the ISPC side samples without the shared value cache first, it is
+  // compared on its own at the end
+  ispc::TAMRVolume_setValueCache(
+      getIE(), nullptr, 0, 0, valueCache.statsData());
+
+  std::cout << "#osp:tamr: filter check, " << numPoints << " points\n";
+
+  std::vector<float> ispcValues(numPoints), hostValues(numPoints);
+  const char *filters[] = {"nearest", "current", "finest", "octant", "trilinear"};
+  for (int f = 0; f < 5; f++) {
+    const TAMRBatchSampler sampler(this, TAMRBatchSampler::Filter(f));
+    const double ispcRate = timeIt([&]() {
+      sampler.sample(worldPoints.data(), ispcValues.data(), numPoints, false);
+    });
+    const double hostRate = timeIt([&]() {
+      reference.resample(
+          Reference::Filter(f), worldPoints.data(), hostValues.data(), numPoints);
+    });
+
+    float maxError = 0.f;
+    for (int i = 0; i < numPoints; i++)
+      maxError = std::max(maxError, std::abs(ispcValues[i] - hostValues[i]));
+    const int mismatches = countMismatches(ispcValues, hostValues);
+    failures += mismatches;
+    std::cout << "  " << filters[f] << ": ispc " << ispcRate
+              << " M/s  host " << hostRate << " M/s  max error " << maxError
+              << ", " << mismatches << " mismatches\n";
+  }
+
+  // points on the center planes of leaves, where two leaves of the same
+  // level used to hand a corner back and forth without terminating
+  std::vector<vec3f> planePoints;
+  for (int i = 0; i < 256; i++) {
+    const box3f leaf =
+        reference.leafBounds(lo + vec3f(u(rng), u(rng), u(rng)) * size);
+    const vec3f center = leaf.center();
+    planePoints.push_back(center);
+    for (int axis = 0; axis < 3; axis++) {
+      vec3f p = leaf.lower + vec3f(u(rng), u(rng), u(rng)) * leaf.size();
+      p[axis] = center[axis];
+      planePoints.push_back(p);
+    }
+  }
+  ispcValues.resize(planePoints.size());
+  hostValues.resize(planePoints.size());
+  for (int f = TAMRBatchSampler::OCTANT; f <= TAMRBatchSampler::TRILINEAR; f++) {
+    const TAMRBatchSampler sampler(this, TAMRBatchSampler::Filter(f));
+    sampler.sample(
+        planePoints.data(), ispcValues.data(), planePoints.size(), false);
+    reference.resample(Reference::Filter(f),
+                       planePoints.data(),
+                       hostValues.data(),
+                       planePoints.size());
+    const int mismatches = countMismatches(ispcValues, hostValues);
+    failures += mismatches;
+    std::cout << "  " << filters[f] << " on " << planePoints.size()
+              << " center plane points: " << mismatches << " mismatches\n";
+  }
+
+  // axis-aligned rays on the finest half-cell grid: they run along center
+  // planes and through level changes, where the per-lane corner cache of a
+  // hinted march and the shared value cache have to give what a cold
+  // lookup gives
+  const vec3f halfCell = 0.5f * gridWorldSpace;
+  const float step     = 0.25f * reduce_min(gridWorldSpace);
+  std::vector<vec3f> rayPoints;
+  for (int axis = 0; axis < 3; axis++) {
+    for (int r = 0; r < 16; r++) {
+      const vec3f k = (lo + vec3f(u(rng), u(rng), u(rng)) * size - worldOrigin) /
+                      halfCell;
+      vec3f p = worldOrigin +
+                vec3f(std::floor(k.x), std::floor(k.y), std::floor(k.z)) *
+                    halfCell;
+      p[axis]     = lo[axis];
+      const int n = std::min(4096, int(size[axis] / step));
+      for (int i = 0; i < n; i++, p[axis] += step)
+        rayPoints.push_back(p);
+    }
+  }
+  const size_t numRayPoints = rayPoints.size();
+
+  std::vector<float> uncachedValues[2];
+  std::vector<float> cachedValues(numRayPoints);
+  hostValues.resize(numRayPoints);
+  for (int f = TAMRBatchSampler::OCTANT; f <= TAMRBatchSampler::TRILINEAR; f++) {
+    std::vector<float> &uncached = uncachedValues[f - TAMRBatchSampler::OCTANT];
+    uncached.resize(numRayPoints);
+    const TAMRBatchSampler sampler(this, TAMRBatchSampler::Filter(f));
+    sampler.sample(rayPoints.data(), cachedValues.data(), numRayPoints, true);
+    sampler.sample(rayPoints.data(), uncached.data(), numRayPoints, false);
+    reference.resample(Reference::Filter(f),
+                       rayPoints.data(),
+                       hostValues.data(),
+                       numRayPoints);
+
+    const int cacheMismatches = countMismatches(cachedValues, uncached);
+    const int mismatches      = countMismatches(cachedValues, hostValues);
+    failures += cacheMismatches + mismatches;
+    std::cout << "  " << filters[f] << " along " << numRayPoints
+              << " ray points: " << cacheMismatches
+              << " cached/uncached mismatches, " << mismatches
+              << " mismatches\n";
+  }
+
+  // the same rays through a shared value cache of its own, once filling it
+  // and once reading it back, both times with and without leaf hints
+  DualValueCache checkCache;
+  checkCache.resize(16);
+  checkCache.enableStats(true);
+  checkCache.clear();
+  ispc::TAMRVolume_setValueCache(getIE(),
+                                 checkCache.slotData(),
+                                 checkCache.size(),
+                                 checkCache.currentEpoch(),
+                                 checkCache.statsData());
+  for (int f = TAMRBatchSampler::OCTANT; f <= TAMRBatchSampler::TRILINEAR; f++) {
+    const std::vector<float> &uncached =
+        uncachedValues[f - TAMRBatchSampler::OCTANT];
+    const TAMRBatchSampler sampler(this, TAMRBatchSampler::Filter(f));
+    int mismatches = 0;
+    for (int pass = 0; pass < 2; pass++) {
+      for (bool coherent : {false, true}) {
+        sampler.sample(
+            rayPoints.data(), cachedValues.data(), numRayPoints, coherent);
+        mismatches += countMismatches(cachedValues, uncached);
+      }
+    }
+    failures += mismatches;
+    std::cout << "  " << filters[f] << " through the value cache: "
+              << mismatches << " mismatches\n";
+  }
+  std::cout << "  value cache: " << checkCache.lookups() << " lookups, "
+            << checkCache.hits() << " hits\n";
+
+  ispc::TAMRVolume_setValueCache(getIE(),
+                                 valueCache.slotData(),
+                                 valueCache.size(),
+                                 valueCache.currentEpoch(),
+                                 valueCache.statsData());
+
+  if (failures > 0) {
+    std::cout << "#osp:tamr: filter check failed, " << failures
+              << " mismatches\n";
+  } else {
+    std::cout << "#osp:tamr: filter check passed\n";
+  }
+  return failures;
+}
+
+const std::vector<VoxelOctreeNode> &TAMRVolume::selectTimestep(int step)
+{
+  step = clamp(step, 0, timeSeries->numSteps() - 1);
+
+  // the prefetch writes the back buffer, it has to be done before it is read
+  if (prefetch.valid())
+    prefetch.wait();
+
+  if (stepBuffers[frontBuffer].step != step) {
+    const int back = 1 - frontBuffer;
+    if (stepBuffers[back].step != step) {
+      timeSeries->decodeStep(step, stepBuffers[back], &stepBuffers[frontBuffer]);
+    }
+    frontBuffer = back;
+  }
+
+  // during playback the next commit asks for step + 1, decode it into the
+  // buffer the renderer stops using once this commit hands over the front
+  const int next = step + 1;
+  if (next < timeSeries->numSteps() &&
+      stepBuffers[1 - frontBuffer].step != next) {
+    TimeSeriesOctree *series          = timeSeries;
+    TimeSeriesOctree::StepBuffer *out = &stepBuffers[1 - frontBuffer];
+    const TimeSeriesOctree::StepBuffer *base = &stepBuffers[frontBuffer];
+    prefetch = std::async(std::launch::async, [=]() {
+      series->decodeStep(next, *out, base);
+    });
+  }
+
+  return stepBuffers[frontBuffer].nodes;
 }
 
 // This registers our volume type with the API so we can call
@@ -4,25 +4,44 @@
 #include "ospcommon/math/vec.h"
 #include "ospcommon/utility/getEnvVar.h"
 #include "ospray/common/Data.h"
+#include "ospray/transferFunction/TransferFunction.h"
 #include "ospray/volume/Volume.h"
 
+#include <functional>
+#include <future>
 #include <limits>
+#include <string>
+#include "DualValueCache.h"
+#include "TAMRBatchSampler.h"
+#include "TimeSeriesOctree.h"
 #include "VoxelOctree.h"
 
 using namespace ospcommon;
 
-/*! abstract base class for any type of scalar volume sampler
- * we will eventually specialize this for bricktree further below
+/*! abstract base class for samplers that take packets of points in SoA
+ * form (separate x, y and z arrays), so implementations can load whole
+ * SIMD registers and descend the tree for all lanes at once
  */
-class ScalarVolumeSampler
+class PacketVolumeSampler
 {
  public:
-  virtual ~ScalarVolumeSampler() {}
-  /*! compute sample at given position */
-  virtual float sample(const vec3f &pos) const = 0;
+  virtual ~PacketVolumeSampler() {}
+  /*! compute the samples at numPoints world space positions */
+  virtual void sample(const float *x,
+                      const float *y,
+                      const float *z,
+                      float *values,
+                      size_t numPoints) const = 0;
 
-  /*! compute gradient at given position */
-  virtual vec3f computeGradient(const vec3f &pos) const = 0;
+  /*! compute samples and gradients at numPoints world space positions */
+  virtual void sampleAndGradient(const float *x,
+                                 const float *y,
+                                 const float *z,
+                                 float *values,
+                                 float *gx,
+                                 float *gy,
+                                 float *gz,
+                                 size_t numPoints) const = 0;
 };
 
 class TAMRVolume : public ospray::Volume
@@ -39,8 +58,25 @@ class TAMRVolume : public ospray::Volume
   // the OSPRay API
   virtual void commit() override;
 
-  ScalarVolumeSampler *createSampler();
-  ScalarVolumeSampler *sampler;
+  PacketVolumeSampler *createSampler();
+  PacketVolumeSampler *sampler{nullptr};
+
+  //! time leaf lookups and the filters on numPoints random points, and
+  //! the filters along rays with and without a leaf hint; needs a
+  //! committed volume, see apps/tamrBenchmark.cpp
+  void runSamplingBenchmark(int numPoints);
+
+  /*! sample numPoints random points with every filter, through the ISPC
+   * kernels and through the host-side OctreeReconstruction, and report
+   * where they disagree and how fast each one is; also compare hinted and
+   * cold octant and trilinear samples along rays through cell centers.
+   * Returns the number of mismatches, see apps/tamrFilterCheck.cpp */
+  int checkFilters(int numPoints);
+
+  //! reconstruction filter installed at the last commit
+  std::string filterMethod{"nearest"};
+  //! host-side sampler of that filter, rebuilt when it is installed
+  TAMRBatchSampler batchSampler{this};
 
   //! Volume size in voxels per dimension. e.g. (4 x 4 x 2)
   vec3i dimensions;
@@ -48,29 +84,106 @@ class TAMRVolume : public ospray::Volume
   vec3f gridOrigin;
   //! Grid spacing in each dimension in world coordinate.
   vec3f gridWorldSpace;
+  //! World space position of gridOrigin.
+  vec3f worldOrigin;
 
   // Feng's code to test the voxeloctree.
-  VoxelOctree *_voxelAccel;
+  VoxelOctree *_voxelAccel{nullptr};
+
+  //! optional time series sharing one topology, selected by 'timestep'
+  TimeSeriesOctree *timeSeries{nullptr};
+
+ private:
+  //! make 'step' the front buffer and prefetch the following one
+  const std::vector<VoxelOctreeNode> &selectTimestep(int step);
+
+  static void installFilter(void *ie, const std::string &filterMethod);
+
+  //! resize the shared value cache, report its hit rate since the last
+  //! commit if 'stats' were counted and start a new epoch
+  void updateValueCache(int log2Size, size_t numNodes, bool stats);
+  void reportValueCache() const;
+
+  //! what a table built from a transfer function depends on; editing it
+  //! sets new color or opacity data or a new value range
+  struct TransferFunctionStamp
+  {
+    ospray::Ref<ospray::TransferFunction> tfn;
+    ospray::Ref<ospray::Data> color;
+    ospray::Ref<ospray::Data> opacity;
+    vec2f valueRange;
+
+    bool operator==(const TransferFunctionStamp &other) const;
+  };
+  static TransferFunctionStamp stampOf(ospray::TransferFunction *tfn);
+
+  /*! rebuild the per-node maximum opacity for the 'transferFunction'
+   * parameter if it or the nodes (of timestep 'step', -1 without a time
+   * series) changed, or drop it if there is none. Nodes edited in place
+   * are only noticed through a new 'voxelOctree'. */
+  void updateNodeMaxOpacity(const std::vector<VoxelOctreeNode> &nodes,
+                            int step);
+
+  //! rebuild the pre-integration table for the 'transferFunction'
+  //! parameter if 'preIntegration' is on, or drop it
+  void updatePreIntegration(const VoxelOctree &octree);
+
+  //! stitched octant corners shared by all render threads
+  DualValueCache valueCache;
+
+  //! the traversal culls nodes with this instead of scanning the transfer
+  //! function it was built for at the last commit
+  std::vector<uint8_t> nodeMaxOpacity;
+  //! what the table was built from
+  TransferFunctionStamp nodeOpacityStamp;
+  const VoxelOctreeNode *nodeOpacityNodes{nullptr};
+  int nodeOpacityStep{-1};
+
+  //! see PreIntegration.ih
+  std::vector<vec4f> preIntegrationTable;
+  //! what the table was built from; commits that change none of it, like
+  //! a new timestep, keep it
+  struct PreIntegrationSource
+  {
+    TransferFunctionStamp tfn;
+    float opacityScaleFactor{0.f};
+    float maxLength{0.f};
+  } preIntegrationSource;
+
+  TimeSeriesOctree::StepBuffer stepBuffers[2];
+  int frontBuffer{0};
+  std::future<void> prefetch;
 };
 
-class TAMRVolumeSampler : public ScalarVolumeSampler
+/*! packet sampler running the ISPC filter kernels of the volume's
+ * current reconstruction filter */
+class TAMRVolumeSampler : public PacketVolumeSampler
 {
  public:
-  TAMRVolumeSampler(TAMRVolume *v) : p4estv(v) {}
+  TAMRVolumeSampler(TAMRVolume *v) : volume(v) {}
 
-  // Please refer to p4est_search.h for reference.
-  // We have access to the p4est_t structure via ospray::data *p4estTree
-  // I will call this structure "p4est" in my comments / pseudocode
-  virtual float sample(const vec3f &pos) const override
+  virtual void sample(const float *x,
+                      const float *y,
+                      const float *z,
+                      float *values,
+                      size_t numPoints) const override
   {
-    return (float)p4estv->_voxelAccel->queryData(pos);
+    volume->batchSampler.sample(x, y, z, values, numPoints);
   }
 
-  virtual vec3f computeGradient(const vec3f &pos) const override
+  virtual void sampleAndGradient(const float *x,
+                                 const float *y,
+                                 const float *z,
+                                 float *values,
+                                 float *gx,
+                                 float *gy,
+                                 float *gz,
+                                 size_t numPoints) const override
   {
-    return vec3f(1, 0, 0);
+    volume->batchSampler.sampleAndGradient(
+        x, y, z, values, gx, gy, gz, numPoints);
   }
 
  private:
-  TAMRVolume *p4estv;
+  TAMRVolume *volume;
 };
@@ -0,0 +1,287 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include "TimeSeriesOctree.h"
+#include "ospcommon/os/FileName.h"
+
+// leaves per independently coded block
+static const size_t TS_BLOCK_SIZE = 1 << 16;
+
+static inline uint32_t floatBits(float f)
+{
+  uint32_t i;
+  memcpy(&i, &f, sizeof(i));
+  return i;
+}
+
+static inline float bitsToFloat(uint32_t i)
+{
+  float f;
+  memcpy(&f, &i, sizeof(f));
+  return f;
+}
+
+static inline void putVarint(std::vector<uint8_t> &out, uint32_t v)
+{
+  while (v >= 0x80) {
+    out.push_back(uint8_t(v) | 0x80);
+    v >>= 7;
+  }
+  out.push_back(uint8_t(v));
+}
+
+static inline uint32_t getVarint(const uint8_t *&p)
+{
+  uint32_t v  = 0;
+  int shift   = 0;
+  uint8_t byte;
+  do {
+    byte = *p++;
+    v |= uint32_t(byte & 0x7f) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+  return v;
+}
+
+static std::vector<size_t> gatherLeafNodeIDs(
+    const std::vector<VoxelOctreeNode> &nodes)
+{
+  std::vector<size_t> leafNodeIDs;
+  for (size_t i = 0; i < nodes.size(); i++)
+    if (nodes[i].isLeaf)
+      leafNodeIDs.push_back(i);
+  return leafNodeIDs;
+}
+
+TimeSeriesOctreeWriter::TimeSeriesOctreeWriter(const std::string &prefix,
+                                               const std::string &topologyFile,
+                                               VoxelOctree &topology,
+                                               int keyframeInterval)
+    : prefix(prefix),
+      topologyFile(topologyFile),
+      keyframeInterval(std::max(keyframeInterval, 1)),
+      binOffset(0)
+{
+  leafNodeIDs = gatherLeafNodeIDs(topology._octreeNodes);
+
+  const std::string binFileName = prefix + ".tsoctbin";
+  bin = fopen(binFileName.c_str(), "wb");
+  if (!bin)
+    throw std::runtime_error("could not write " + binFileName);
+}
+
+TimeSeriesOctreeWriter::~TimeSeriesOctreeWriter()
+{
+  if (bin)
+    fclose(bin);
+}
+
+void TimeSeriesOctreeWriter::addStep(VoxelOctree &tree)
+{
+  if (!bin)
+    throw std::runtime_error("time series " + prefix + " is already finished");
+
+  const size_t numLeaves = leafNodeIDs.size();
+  const size_t numBlocks = (numLeaves + TS_BLOCK_SIZE - 1) / TS_BLOCK_SIZE;
+  const bool keyframe    = steps.size() % keyframeInterval == 0;
+
+  std::vector<uint32_t> bits(numLeaves);
+  tasking::parallel_for(numLeaves, [&](size_t i) {
+    bits[i] = floatBits((float)tree._octreeNodes[leafNodeIDs[i]].getValue());
+  });
+
+  std::vector<std::vector<uint8_t>> blocks(numBlocks);
+  tasking::parallel_for(numBlocks, [&](size_t b) {
+    size_t begin = b * TS_BLOCK_SIZE;
+    size_t end   = std::min(numLeaves, begin + TS_BLOCK_SIZE);
+    std::vector<uint8_t> &out = blocks[b];
+    if (keyframe) {
+      out.resize((end - begin) * sizeof(uint32_t));
+      memcpy(out.data(), &bits[begin], out.size());
+    } else {
+      for (size_t i = begin; i < end; i++)
+        putVarint(out, bits[i] ^ prevBits[i]);
+    }
+  });
+
+  // block offset table relative to the start of the step, then the blocks
+  std::vector<uint64_t> blockOffsets(numBlocks + 1);
+  blockOffsets[0] = (numBlocks + 1) * sizeof(uint64_t);
+  for (size_t b = 0; b < numBlocks; b++)
+    blockOffsets[b + 1] = blockOffsets[b] + blocks[b].size();
+
+  fwrite(blockOffsets.data(), sizeof(uint64_t), blockOffsets.size(), bin);
+  for (const std::vector<uint8_t> &block : blocks)
+    fwrite(block.data(), 1, block.size(), bin);
+
+  StepRecord record;
+  record.offset   = binOffset;
+  record.bytes    = blockOffsets[numBlocks];
+  record.keyframe = keyframe;
+  record.vRange   = tree._octreeNodes[0].vRange;
+  steps.push_back(record);
+  binOffset += record.bytes;
+
+  std::cout << "Time series step " << steps.size() - 1 << ": "
+            << (keyframe ? "keyframe, " : "delta, ") << record.bytes
+            << " bytes for " << numLeaves << " leaves\n";
+
+  prevBits.swap(bits);
+}
+
+void TimeSeriesOctreeWriter::finish()
+{
+  if (!bin)
+    return;
+  fclose(bin);
+  bin = NULL;
+
+  const std::string headerFile = prefix + ".tsoct";
+  FILE *ts = fopen(headerFile.c_str(), "w");
+  if (!ts)
+    throw std::runtime_error("could not write " + headerFile);
+
+  fprintf(ts, "<?xml?>\n");
+  fprintf(ts, "<ospray>\n");
+  {
+    fprintf(ts, "  <TimeSeries\n");
+    {
+      // relative to the header so that the files can be moved together
+      fprintf(ts, "    topology=\"%s\"\n", FileName(topologyFile).base().c_str());
+      fprintf(ts, "    numSteps=\"%zu\"\n", steps.size());
+      fprintf(ts, "    keyframeInterval=\"%i\"\n", keyframeInterval);
+      fprintf(ts, "    numLeaves=\"%zu\"\n", leafNodeIDs.size());
+      fprintf(ts, "    blockSize=\"%zu\"\n", TS_BLOCK_SIZE);
+      fprintf(ts, "    >\n");
+    }
+    for (const StepRecord &s : steps) {
+      fprintf(ts,
+              "    <Step offset=\"%lu\" bytes=\"%lu\" keyframe=\"%i\" "
+              "vRange=\"%f %f\">\n",
+              (unsigned long)s.offset,
+              (unsigned long)s.bytes,
+              s.keyframe ? 1 : 0,
+              s.vRange.lower,
+              s.vRange.upper);
+      fprintf(ts, "    </Step>\n");
+    }
+    fprintf(ts, "  </TimeSeries>\n");
+  }
+  fprintf(ts, "</ospray>\n");
+  fclose(ts);
+
+  std::cout << "Save time series into " << headerFile << std::endl;
+}
+
+TimeSeriesOctree::TimeSeriesOctree(const std::string &fileName)
+{
+  std::shared_ptr<xml::XMLDoc> doc = xml::readXML(fileName.c_str());
+  if (!doc)
+    throw std::runtime_error("could not read time series file:" + fileName);
+  const xml::Node &osprayNode = doc->child[0];
+  assert(osprayNode.name == "ospray");
+  const xml::Node &tsNode = osprayNode.child[0];
+  assert(tsNode.name == "TimeSeries");
+
+  blockSize = std::stoull(tsNode.getProp("blockSize"));
+  for (const xml::Node &node : tsNode.child) {
+    if (node.name != "Step")
+      continue;
+    StepRecord s;
+    s.offset   = std::stoull(node.getProp("offset"));
+    s.bytes    = std::stoull(node.getProp("bytes"));
+    s.keyframe = std::stoi(node.getProp("keyframe")) != 0;
+    steps.push_back(s);
+  }
+  if (steps.empty() || !steps[0].keyframe)
+    throw std::runtime_error("time series " + fileName +
+                             " does not start with a keyframe");
+
+  FileName header(fileName);
+  topology.mapOctreeFromFile(header.path() + tsNode.getProp("topology"));
+  leafNodeIDs = gatherLeafNodeIDs(topology._octreeNodes);
+  if (leafNodeIDs.size() != std::stoull(tsNode.getProp("numLeaves")))
+    throw std::runtime_error("time series " + fileName +
+                             " does not match its topology");
+
+  const std::string binFileName = fileName + "bin";
+  int fd = open(binFileName.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("could not open time series file " + binFileName);
+  struct stat statBuf = {0};
+  fstat(fd, &statBuf);
+  mappingBytes = statBuf.st_size;
+  void *m = mmap(NULL, mappingBytes, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (m == MAP_FAILED)
+    throw std::runtime_error("could not map time series file " + binFileName);
+  mapping = static_cast<const uint8_t *>(m);
+
+  std::cout << "Mapped time series with " << steps.size() << " steps and "
+            << leafNodeIDs.size() << " leaves from " << fileName << "\n";
+}
+
+TimeSeriesOctree::~TimeSeriesOctree()
+{
+  munmap((void *)mapping, mappingBytes);
+}
+
+void TimeSeriesOctree::applyStep(int step, std::vector<uint32_t> &leafBits) const
+{
+  const StepRecord &s     = steps[step];
+  const uint8_t *stepData = mapping + s.offset;
+  const uint64_t *blockOffsets = reinterpret_cast<const uint64_t *>(stepData);
+  const size_t numLeaves       = leafNodeIDs.size();
+  const size_t numBlocks       = (numLeaves + blockSize - 1) / blockSize;
+
+  tasking::parallel_for(numBlocks, [&](size_t b) {
+    size_t begin     = b * blockSize;
+    size_t end       = std::min(numLeaves, begin + blockSize);
+    const uint8_t *p = stepData + blockOffsets[b];
+    if (s.keyframe) {
+      memcpy(&leafBits[begin], p, (end - begin) * sizeof(uint32_t));
+    } else {
+      for (size_t i = begin; i < end; i++)
+        leafBits[i] ^= getVarint(p);
+    }
+  });
+}
+
+void TimeSeriesOctree::decodeStep(int step,
+                                  StepBuffer &out,
+                                  const StepBuffer *base) const
+{
+  int keyframe = step;
+  while (!steps[keyframe].keyframe)
+    keyframe--;
+
+  int first = keyframe;
+  if (base && base->step >= keyframe && base->step <= step) {
+    if (&out != base)
+      out.leafBits = base->leafBits;
+    first = base->step + 1;
+  } else {
+    out.leafBits.resize(leafNodeIDs.size());
+  }
+
+  for (int s = first; s <= step; s++)
+    applyStep(s, out.leafBits);
+
+  if (out.nodes.size() != topology._octreeNodes.size())
+    out.nodes = topology._octreeNodes;
+
+  tasking::parallel_for(leafNodeIDs.size(), [&](size_t i) {
+    VoxelOctreeNode &leaf = out.nodes[leafNodeIDs[i]];
+    float value           = bitsToFloat(out.leafBits[i]);
+    leaf.childDescripteOrValue = doulbeBitsToUint((double)value);
+    leaf.vRange                = range1f(value);
+  });
+  VoxelOctree::updateNodeRanges(out.nodes);
+  out.step = step;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "VoxelOctree.h"
+
+/*! Time-series container stored next to a regular octree file.
+ *
+ * All timesteps share the topology of one '.oct' file, only the leaf values
+ * change. They are stored as float bits in leaf order: a raw keyframe every
+ * 'keyframeInterval' steps and, in between, the XOR with the previous step
+ * written as LEB128 varints. Slowly changing values only differ in their low
+ * mantissa bits, so most deltas take one or two bytes. The leaves are coded
+ * in independent blocks, which lets a step decode in parallel.
+ *
+ * '<prefix>.tsoct' is the XML header, '<prefix>.tsoctbin' holds the steps.
+ */
+class TimeSeriesOctreeWriter
+{
+ public:
+  TimeSeriesOctreeWriter(const std::string &prefix,
+                         const std::string &topologyFile,
+                         VoxelOctree &topology,
+                         int keyframeInterval);
+  ~TimeSeriesOctreeWriter();
+
+  //! append the leaf values of 'tree', which must share the topology
+  void addStep(VoxelOctree &tree);
+  //! write the header, no steps can be added afterwards
+  void finish();
+
+ private:
+  struct StepRecord
+  {
+    uint64_t offset;
+    uint64_t bytes;
+    bool keyframe;
+    range1f vRange;
+  };
+
+  std::string prefix;
+  std::string topologyFile;
+  int keyframeInterval;
+  std::vector<size_t> leafNodeIDs;
+  std::vector<uint32_t> prevBits;
+  std::vector<StepRecord> steps;
+  FILE *bin;
+  uint64_t binOffset;
+};
+
+class TimeSeriesOctree
+{
+ public:
+  //! one decoded timestep, the volume keeps two of them for playback
+  struct StepBuffer
+  {
+    int step = -1;
+    std::vector<uint32_t> leafBits;
+    std::vector<VoxelOctreeNode> nodes;
+  };
+
+  explicit TimeSeriesOctree(const std::string &fileName);
+  ~TimeSeriesOctree();
+
+  int numSteps() const { return (int)steps.size(); }
+
+  /*! decode 'step' into 'out'. If 'base' already holds an earlier step after
+   * the same keyframe only the deltas in between are applied, otherwise
+   * decoding starts at the keyframe. */
+  void decodeStep(int step, StepBuffer &out, const StepBuffer *base) const;
+
+  //! shared topology, its leaf values are the ones of the first step
+  VoxelOctree topology;
+
+ private:
+  struct StepRecord
+  {
+    uint64_t offset;
+    uint64_t bytes;
+    bool keyframe;
+  };
+
+  void applyStep(int step, std::vector<uint32_t> &leafBits) const;
+
+  std::vector<StepRecord> steps;
+  std::vector<size_t> leafNodeIDs;
+  size_t blockSize;
+
+  const uint8_t *mapping;
+  size_t mappingBytes;
+};
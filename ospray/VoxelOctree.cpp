@@ -1,4 +1,9 @@
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <iostream>
 #include <stdexcept>
 #include "ospcommon/math/box.h"
@@ -37,7 +42,8 @@ VoxelOctree::VoxelOctree(const voxel *voxels,
                          range1f voxelRange,
                          box3f actualBounds,
                          vec3f gridWorldSpace,
-                         vec3f worldOrigin)
+                         vec3f worldOrigin,
+                         OctreeSubtreeStore *subtreeStore)
 {
   _actualBounds        = actualBounds;
   _virtualBounds       = actualBounds;
@@ -52,11 +58,14 @@ VoxelOctree::VoxelOctree(const voxel *voxels,
 
   time_point t1 = Time();
   std::cout << green << "Building voxelOctree..." << "\n";
-  VoxelOctreeNode root;
+  VoxelOctreeNode root = VoxelOctreeNode();
   root.vRange = voxelRange;
   _octreeNodes.push_back(root);  // root
   _octreeNodes[0].childDescripteOrValue = 0;
-  buildOctree(0, _virtualBounds, NULL, vNum);
+  if (subtreeStore)
+    buildOctreeFromSubtrees(subtreeStore);
+  else
+    buildOctree(0, _virtualBounds, NULL, vNum);
   _octreeNodes[0].childDescripteOrValue |= 0x100;
   _voxels = NULL;
 
@@ -66,6 +75,180 @@ VoxelOctree::VoxelOctree(const voxel *voxels,
   std::cout <<"Building time: " << buildTime <<" s" << reset<<"\n";
 }
 
+void VoxelOctree::partitionOctants(const MortonCell *begin,
+                                   const MortonCell *end,
+                                   int level,
+                                   const MortonCell *octantBegin[9])
+{
+  octantBegin[0] = begin;
+  octantBegin[8] = end;
+  for (int o = 1; o < 8; o++) {
+    octantBegin[o] = std::partition_point(
+        octantBegin[o - 1], end, [&](const MortonCell &c) {
+          return int((c.key >> (3 * level)) & 7) < o;
+        });
+  }
+}
+
+range1f VoxelOctree::buildSortedSubtree(std::vector<VoxelOctreeNode> &nodes,
+                                        size_t nodeID,
+                                        const MortonCell *begin,
+                                        const MortonCell *end,
+                                        int level)
+{
+  if (level < 0)
+    throw std::runtime_error("VoxelOctree: overlapping cells in the input");
+
+  const MortonCell *octantBegin[9];
+  partitionOctants(begin, end, level, octantBegin);
+
+  size_t childOffset = nodes.size() - nodeID;
+
+  int childCount = 0;
+  int childIndice[8];
+  uint32_t childMask = 0;
+  for (int i = 0; i < 8; i++) {
+    if (octantBegin[i + 1] != octantBegin[i]) {
+      childMask |= 1 << i;
+      childIndice[childCount++] = i;
+    }
+  }
+
+  nodes.resize(nodes.size() + childCount);
+
+  range1f vRange;
+  for (int i = 0; i < childCount; i++) {
+    int idx           = childIndice[i];
+    size_t childIndex = nodeID + childOffset + i;
+    range1f childRange;
+    if (octantBegin[idx + 1] - octantBegin[idx] == 1) {
+      const float value = octantBegin[idx]->value;
+      nodes[childIndex].isLeaf                = 1;
+      nodes[childIndex].childDescripteOrValue = doulbeBitsToUint((double)value);
+      childRange = range1f(value);
+    } else {
+      childRange = buildSortedSubtree(nodes,
+                                      childIndex,
+                                      octantBegin[idx],
+                                      octantBegin[idx + 1],
+                                      level - 1);
+    }
+    nodes[childIndex].vRange = childRange;
+    vRange.extend(childRange);
+  }
+
+  nodes[nodeID].childDescripteOrValue = (childOffset << 8) | childMask;
+  return vRange;
+}
+
+VoxelOctree::VoxelOctree(const OctreeCell *cells,
+                         const float *values,
+                         const size_t cellNum,
+                         const vec3i &gridMin,
+                         int minLevel,
+                         box3f actualBounds,
+                         vec3f gridWorldSpace,
+                         vec3f worldOrigin,
+                         OctreeSubtreeStore *subtreeStore)
+{
+  _actualBounds        = actualBounds;
+  _virtualBounds       = actualBounds;
+  _virtualBounds.upper = vec3f(max(
+      max(roundToPow2(actualBounds.upper.x), roundToPow2(actualBounds.upper.y)),
+      roundToPow2(actualBounds.upper.z)));
+
+  _gridWorldSpace = gridWorldSpace;
+  _worldOrigin    = worldOrigin;
+  _voxels         = NULL;
+  vNum            = cellNum;
+
+  if (cellNum < 2)
+    throw std::runtime_error("VoxelOctree: need at least two cells");
+
+  // the root splits at half the virtual size, i.e. at bit rootLevel - 1
+  int rootLevel = 0;
+  while ((1 << rootLevel) < int(_virtualBounds.upper.x))
+    rootLevel++;
+  if (rootLevel > 21)
+    throw std::runtime_error("VoxelOctree: grid exceeds the 21 bit Morton keys");
+
+  time_point t1 = Time();
+  std::cout << green << "Building voxelOctree from integer cells..." << "\n";
+
+  // the values are gathered while keying, so both inputs are read in order
+  std::vector<MortonCell> sorted(cellNum);
+  tasking::parallel_for(cellNum, [&](size_t i) {
+    sorted[i].key   = mortonKey(cells[i].gridLower(gridMin, minLevel));
+    sorted[i].value = values[i];
+  });
+  tbb::parallel_sort(sorted.begin(), sorted.end());
+  std::cout << "Sorting " << cellNum << " cells: " << Time(t1) << " s\n";
+
+  const MortonCell *octantBegin[9];
+  partitionOctants(
+      sorted.data(), sorted.data() + cellNum, rootLevel - 1, octantBegin);
+
+  int childCount = 0;
+  int childIndice[8];
+  uint32_t childMask = 0;
+  for (int i = 0; i < 8; i++) {
+    if (octantBegin[i + 1] != octantBegin[i]) {
+      childMask |= 1 << i;
+      childIndice[childCount++] = i;
+    }
+  }
+
+  // the root children are independent, build their subtrees in parallel
+  std::vector<std::vector<VoxelOctreeNode>> subtrees(childCount);
+  tasking::parallel_for(childCount, [&](int i) {
+    int idx = childIndice[i];
+    if (octantBegin[idx + 1] - octantBegin[idx] == 1)
+      return;
+    if (subtreeStore && subtreeStore->loadSubtree(idx, subtrees[i])) {
+      std::cout << "Restored subtree " << idx << " (" << subtrees[i].size()
+                << " nodes) from checkpoint\n";
+      updateNodeRanges(subtrees[i]);
+      return;
+    }
+    subtrees[i].resize(1);
+    subtrees[i][0].vRange = buildSortedSubtree(subtrees[i],
+                                               0,
+                                               octantBegin[idx],
+                                               octantBegin[idx + 1],
+                                               rootLevel - 2);
+    if (subtreeStore)
+      subtreeStore->saveSubtree(idx, subtrees[i]);
+  });
+
+  VoxelOctreeNode root       = VoxelOctreeNode();
+  root.childDescripteOrValue = 0x100 | childMask;
+  _octreeNodes.push_back(root);
+  for (int i = 0; i < childCount; i++)
+    _octreeNodes.push_back(VoxelOctreeNode());
+
+  for (int i = 0; i < childCount; i++) {
+    int idx           = childIndice[i];
+    size_t childIndex = 1 + i;
+    if (subtrees[i].empty()) {
+      const float value = octantBegin[idx]->value;
+      _octreeNodes[childIndex].isLeaf = 1;
+      _octreeNodes[childIndex].childDescripteOrValue =
+          doulbeBitsToUint((double)value);
+      _octreeNodes[childIndex].vRange = range1f(value);
+    } else {
+      _octreeNodes[childIndex].vRange = subtrees[i][0].vRange;
+      attachSubtree(childIndex, subtrees[i]);
+      std::vector<VoxelOctreeNode>().swap(subtrees[i]);
+    }
+    _octreeNodes[0].vRange.extend(_octreeNodes[childIndex].vRange);
+  }
+
+  printOctreeNode(0);
+
+  double buildTime = Time(t1);
+  std::cout << "Building time: " << buildTime << " s" << reset << "\n";
+}
+
 void VoxelOctree::printOctree()
 {
   printf("Octree Node Number: %ld\n", _octreeNodes.size());
@@ -102,13 +285,18 @@ void VoxelOctree::saveOctree(const std::string &fileName)
   
   fclose(bin);
 
+  saveOctreeHeader(octFile, _octreeNodes.size());
+}
+
+void VoxelOctree::saveOctreeHeader(const std::string &octFile, size_t nodeNum)
+{
   FILE *oct = fopen(octFile.c_str(), "w");
   fprintf(oct, "<?xml?>\n");
   fprintf(oct, "<ospray>\n");
   {
     fprintf(oct, "  <Octree\n");
     {
-      fprintf(oct, "    nodeSize=\"%li\"\n", _octreeNodes.size());
+      fprintf(oct, "    nodeSize=\"%li\"\n", nodeNum);
       fprintf(oct, "    actualBound=\"%f %f %f %f %f %f\"\n",
               _actualBounds.lower.x,_actualBounds.lower.y,_actualBounds.lower.z,
               _actualBounds.upper.x,_actualBounds.upper.y,_actualBounds.upper.z);
@@ -126,7 +314,7 @@ void VoxelOctree::saveOctree(const std::string &fileName)
   std::cout<<"Save octree into " << octFile << std::endl;
 }
 
-void VoxelOctree::mapOctreeFromFile(const std::string &fileName)
+size_t VoxelOctree::readOctreeHeader(const std::string &fileName)
 {
   std::shared_ptr<xml::XMLDoc> doc = xml::readXML(fileName.c_str());
   if (!doc)
@@ -138,8 +326,6 @@ void VoxelOctree::mapOctreeFromFile(const std::string &fileName)
   assert(octTreeNode->name == "Octree");
 
   size_t nodeSize = std::stoll(octTreeNode->getProp("nodeSize"));
-  this->_octreeNodes.clear();
-  this->_octreeNodes.resize(nodeSize);
 
   sscanf(octTreeNode->getProp("actualBound").c_str(),"%f %f %f %f %f %f",
         &_actualBounds.lower.x, &_actualBounds.lower.y, &_actualBounds.lower.z,
@@ -152,6 +338,15 @@ void VoxelOctree::mapOctreeFromFile(const std::string &fileName)
   float gridWidthInWorld = std::stof(octTreeNode->getProp("gridWidthInWorld"));
   _gridWorldSpace = vec3f(gridWidthInWorld);
 
+  return nodeSize;
+}
+
+void VoxelOctree::mapOctreeFromFile(const std::string &fileName)
+{
+  size_t nodeSize = readOctreeHeader(fileName);
+  this->_octreeNodes.clear();
+  this->_octreeNodes.resize(nodeSize);
+
   std::string binFileName = fileName + "bin";
   FILE *file              = fopen(binFileName.c_str(), "rb");
   if (!file)
@@ -189,6 +384,23 @@ double VoxelOctree::queryData(vec3f pos)
     return 0.0;
   }
 
+  size_t nodeID = findLeafNode(pos);
+  // no leaf, return invalid value 0
+  if (nodeID == size_t(-1))
+    return 0.0;
+
+  return _octreeNodes[nodeID].getValue();
+}
+
+static inline vec3f octantLower(const vec3f &lower, float halfWidth, int octant)
+{
+  return lower + vec3f((octant & 1) ? halfWidth : 0.f,
+                       (octant & 2) ? halfWidth : 0.f,
+                       (octant & 4) ? halfWidth : 0.f);
+}
+
+size_t VoxelOctree::findLeafNode(const vec3f &pos)
+{
   uint64_t parent       = 0;
   VoxelOctreeNode _node = _octreeNodes[parent];
   vec3f lowerC(0.0);
@@ -209,9 +421,8 @@ double VoxelOctree::queryData(vec3f pos)
     uint64_t childOffset = _node.getChildOffset();
 
     bool hasChild = childMask & (1 << octantMask);
-    // no leaf, return invalid value 0
     if (!hasChild)
-      return 0.0;
+      return size_t(-1);
 
     uint8_t rightSibling = (1 << octantMask) - 1;
 
@@ -221,7 +432,7 @@ double VoxelOctree::queryData(vec3f pos)
     parent += childOffset + childIndex;
 
     if (parent >= _octreeNodes.size())
-      break;
+      return size_t(-1);
 
     _node = _octreeNodes[parent];
 
@@ -232,7 +443,391 @@ double VoxelOctree::queryData(vec3f pos)
     width *= 0.5;
   }
 
-  return _node.getValue();
+  return parent;
+}
+
+size_t VoxelOctree::findLeafNode(const vec3f &pos, std::vector<PathEntry> &path)
+{
+  // climb to the deepest node on the previous path that contains pos, the
+  // root is kept for points outside of it like findLeafNode(pos) does
+  while (path.size() > 1) {
+    const PathEntry &e = path.back();
+    if (pos.x >= e.lower.x && pos.x < e.lower.x + e.width &&
+        pos.y >= e.lower.y && pos.y < e.lower.y + e.width &&
+        pos.z >= e.lower.z && pos.z < e.lower.z + e.width)
+      break;
+    path.pop_back();
+  }
+  if (path.empty())
+    path.push_back({0, vec3f(0.f), _virtualBounds.size().x});
+
+  while (true) {
+    const PathEntry e     = path.back();
+    VoxelOctreeNode &node = _octreeNodes[e.nodeID];
+    if (node.isLeaf)
+      return e.nodeID;
+
+    const float halfWidth = 0.5f * e.width;
+    const vec3f center    = e.lower + vec3f(halfWidth);
+    int octantMask        = 0;
+    if (pos.x >= center.x)
+      octantMask |= 1;
+    if (pos.y >= center.y)
+      octantMask |= 2;
+    if (pos.z >= center.z)
+      octantMask |= 4;
+
+    const uint8_t childMask = node.getChildMask();
+    if (!(childMask & (1 << octantMask)))
+      return size_t(-1);
+
+    const size_t childID = e.nodeID + node.getChildOffset() +
+                           CHILD_BIT_COUNT[childMask & ((1 << octantMask) - 1)];
+    if (childID >= _octreeNodes.size())
+      return size_t(-1);
+
+    path.push_back({childID, octantLower(e.lower, halfWidth, octantMask), halfWidth});
+  }
+}
+
+// consecutive cells of the input files are mostly close to each other, so
+// each block of them keeps the path to its last leaf instead of descending
+// from the root for every cell
+static const size_t LEAF_UPDATE_BLOCK = 1 << 16;
+
+void VoxelOctree::updateLeafValues(const voxel *voxels, const size_t voxelNum)
+{
+  // every voxel owns exactly one leaf, so the writes never collide
+  const size_t numBlocks = (voxelNum + LEAF_UPDATE_BLOCK - 1) / LEAF_UPDATE_BLOCK;
+  tasking::parallel_for(numBlocks, [&](size_t b) {
+    std::vector<PathEntry> path;
+    const size_t end = std::min(voxelNum, (b + 1) * LEAF_UPDATE_BLOCK);
+    for (size_t i = b * LEAF_UPDATE_BLOCK; i < end; i++) {
+      const voxel &v = voxels[i];
+      vec3f pos = (v.lower - _worldOrigin + 0.5 * v.width) / _gridWorldSpace;
+      size_t nodeID = findLeafNode(pos, path);
+      if (nodeID == size_t(-1))
+        continue;
+      _octreeNodes[nodeID].childDescripteOrValue =
+          doulbeBitsToUint((double)v.value);
+      _octreeNodes[nodeID].vRange = range1f(v.value);
+    }
+  });
+
+  updateNodeRanges(_octreeNodes);
+}
+
+void VoxelOctree::updateLeafValues(const OctreeCell *cells,
+                                   const float *values,
+                                   const size_t cellNum,
+                                   const vec3i &gridMin,
+                                   int minLevel)
+{
+  const size_t numBlocks = (cellNum + LEAF_UPDATE_BLOCK - 1) / LEAF_UPDATE_BLOCK;
+  tasking::parallel_for(numBlocks, [&](size_t b) {
+    std::vector<PathEntry> path;
+    const size_t end = std::min(cellNum, (b + 1) * LEAF_UPDATE_BLOCK);
+    for (size_t i = b * LEAF_UPDATE_BLOCK; i < end; i++) {
+      // the cell centers are exact in float for grids up to 2^23 cells wide
+      const float width = float(1 << (cells[i].level - minLevel));
+      vec3f pos = vec3f(cells[i].gridLower(gridMin, minLevel)) + 0.5f * width;
+      size_t nodeID = findLeafNode(pos, path);
+      if (nodeID == size_t(-1))
+        continue;
+      _octreeNodes[nodeID].childDescripteOrValue =
+          doulbeBitsToUint((double)values[i]);
+      _octreeNodes[nodeID].vRange = range1f(values[i]);
+    }
+  });
+
+  updateNodeRanges(_octreeNodes);
+}
+
+void VoxelOctree::updateNodeRanges(std::vector<VoxelOctreeNode> &nodes)
+{
+  // children are always stored behind their parent, so a single backward
+  // sweep sees every child range before the parent is updated
+  for (size_t i = nodes.size(); i-- > 0;) {
+    VoxelOctreeNode &node = nodes[i];
+    if (node.isLeaf)
+      continue;
+    range1f vRange;
+    size_t firstChild = i + node.getChildOffset();
+    for (uint32_t c = 0; c < node.getChildNum(); c++)
+      vRange.extend(nodes[firstChild + c].vRange);
+    node.vRange = vRange;
+  }
+}
+
+static inline bool overlaps(const vec3f &lower, float width, const box3f &roi)
+{
+  return lower.x < roi.upper.x && lower.x + width > roi.lower.x &&
+         lower.y < roi.upper.y && lower.y + width > roi.lower.y &&
+         lower.z < roi.upper.z && lower.z + width > roi.lower.z;
+}
+
+std::shared_ptr<VoxelOctree> VoxelOctree::extractRegion(const box3f &roi,
+                                                        int maxDepth)
+{
+  return extractRegion(_octreeNodes.data(),
+                       _actualBounds,
+                       _virtualBounds,
+                       _gridWorldSpace,
+                       _worldOrigin,
+                       roi,
+                       maxDepth);
+}
+
+std::shared_ptr<VoxelOctree> VoxelOctree::coarsen(int maxDepth)
+{
+  return extractRegion(_virtualBounds, maxDepth);
+}
+
+std::shared_ptr<VoxelOctree> VoxelOctree::extractRegionFromFile(
+    const std::string &octFile,
+    const vec3f &worldOrigin,
+    const box3f &roi,
+    int maxDepth)
+{
+  VoxelOctree header;
+  const size_t nodeSize = header.readOctreeHeader(octFile);
+
+  const std::string binFileName = octFile + "bin";
+  int fd = open(binFileName.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("could not open octree bin file " + binFileName);
+  const size_t numBytes = nodeSize * sizeof(VoxelOctreeNode);
+  void *mapping = mmap(NULL, numBytes, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+    throw std::runtime_error("could not map octree bin file " + binFileName);
+  // only the subtrees overlapping the region are visited
+  madvise(mapping, numBytes, MADV_RANDOM);
+
+  std::shared_ptr<VoxelOctree> region =
+      extractRegion(static_cast<const VoxelOctreeNode *>(mapping),
+                    header._actualBounds,
+                    header._virtualBounds,
+                    header._gridWorldSpace,
+                    worldOrigin,
+                    roi,
+                    maxDepth);
+  munmap(mapping, numBytes);
+  return region;
+}
+
+std::shared_ptr<VoxelOctree> VoxelOctree::extractRegion(
+    const VoxelOctreeNode *nodes,
+    const box3f &actualBounds,
+    const box3f &virtualBounds,
+    const vec3f &gridWorldSpace,
+    const vec3f &worldOrigin,
+    const box3f &roi,
+    int maxDepth)
+{
+  // descend while the whole region falls into a single inner child
+  size_t rootID = 0;
+  vec3f lower   = virtualBounds.lower;
+  float width   = virtualBounds.size().x;
+  while (true) {
+    VoxelOctreeNode node = nodes[rootID];
+    vec3f center         = lower + vec3f(0.5f * width);
+    int octant           = 0;
+    bool split           = false;
+    for (int axis = 0; axis < 3; axis++) {
+      if (roi.lower[axis] >= center[axis])
+        octant |= 1 << axis;
+      else if (roi.upper[axis] > center[axis])
+        split = true;
+    }
+    if (split || !(node.getChildMask() & (1 << octant)))
+      break;
+
+    size_t childID = rootID + node.getChildOffset() +
+                     CHILD_BIT_COUNT[node.getChildMask() & ((1 << octant) - 1)];
+    if (nodes[childID].isLeaf)
+      break;
+
+    rootID = childID;
+    lower  = octantLower(lower, 0.5f * width, octant);
+    width *= 0.5f;
+  }
+
+  std::shared_ptr<VoxelOctree> region = std::make_shared<VoxelOctree>();
+  region->_gridWorldSpace = gridWorldSpace;
+  region->_worldOrigin    = worldOrigin + lower * gridWorldSpace;
+  region->_virtualBounds  = box3f(vec3f(0.f), vec3f(width));
+
+  const box3f localROI(roi.lower - lower, roi.upper - lower);
+  box3f keptBounds;
+  std::vector<CollapsedNode> collapsed;
+  region->_octreeNodes.push_back(VoxelOctreeNode());
+  if (maxDepth == 0 || nodes[rootID].isLeaf) {
+    // the new root is the only cell
+    keptBounds = box3f(vec3f(0.f), vec3f(width));
+    if (nodes[rootID].isLeaf)
+      region->_octreeNodes[0] = nodes[rootID];
+    else
+      collapsed.push_back({rootID, 0});
+  } else {
+    region->copyRegion(nodes,
+                       rootID,
+                       0,
+                       vec3f(0.f),
+                       width,
+                       localROI,
+                       0,
+                       maxDepth,
+                       keptBounds,
+                       collapsed);
+    region->_octreeNodes[0].childDescripteOrValue |= 0x100;
+  }
+
+  // Every collapsed subtree is stored contiguously in the source, so each
+  // task streams through its own block of nodes.
+  tasking::parallel_for(collapsed.size(), [&](size_t i) {
+    double valueSum = 0.0, volumeSum = 0.0;
+    std::vector<std::pair<size_t, double>> stack;
+    stack.push_back(std::make_pair(collapsed[i].srcID, 1.0));
+    while (!stack.empty()) {
+      size_t nodeID = stack.back().first;
+      double volume = stack.back().second;
+      stack.pop_back();
+
+      VoxelOctreeNode node = nodes[nodeID];
+      if (node.isLeaf) {
+        valueSum += node.getValue() * volume;
+        volumeSum += volume;
+        continue;
+      }
+      size_t firstChild = nodeID + node.getChildOffset();
+      for (uint32_t c = 0; c < node.getChildNum(); c++)
+        stack.push_back(std::make_pair(firstChild + c, volume * 0.125));
+    }
+
+    const double average = volumeSum > 0.0 ? valueSum / volumeSum : 0.0;
+    VoxelOctreeNode &leaf      = region->_octreeNodes[collapsed[i].dstID];
+    leaf.isLeaf                = 1;
+    leaf.childDescripteOrValue = doulbeBitsToUint(average);
+    leaf.vRange                = range1f(average);
+  });
+  updateNodeRanges(region->_octreeNodes);
+
+  // the grid of the cropped tree starts at its root, just like a fresh build.
+  // Collapsed leaves may reach past the data, which the bounds must not.
+  region->_actualBounds =
+      keptBounds.empty()
+          ? box3f(vec3f(0.f), vec3f(0.f))
+          : box3f(vec3f(0.f), min(keptBounds.upper, actualBounds.upper - lower));
+
+  std::cout << "Extracted " << region->_octreeNodes.size()
+            << " octree nodes, new root is node " << rootID << " of width "
+            << width << "\n";
+  return region;
+}
+
+void VoxelOctree::copyRegion(const VoxelOctreeNode *src,
+                             size_t srcID,
+                             size_t dstID,
+                             const vec3f &lower,
+                             float width,
+                             const box3f &roi,
+                             int depth,
+                             int maxDepth,
+                             box3f &keptBounds,
+                             std::vector<CollapsedNode> &collapsed)
+{
+  VoxelOctreeNode node = src[srcID];
+  const uint8_t childMask = node.getChildMask();
+  const size_t firstChild = srcID + node.getChildOffset();
+  const float halfWidth   = 0.5f * width;
+
+  int childCount = 0;
+  size_t srcChild[8];
+  int childOctant[8];
+  uint32_t newMask = 0;
+  for (int i = 0; i < 8; i++) {
+    if (!(childMask & (1 << i)))
+      continue;
+    if (!overlaps(octantLower(lower, halfWidth, i), halfWidth, roi))
+      continue;
+    srcChild[childCount] =
+        firstChild + CHILD_BIT_COUNT[childMask & ((1 << i) - 1)];
+    childOctant[childCount++] = i;
+    newMask |= 1 << i;
+  }
+
+  size_t childOffset = _octreeNodes.size() - dstID;
+
+  // push children node into the buffer, inner ones are linked below
+  for (int i = 0; i < childCount; i++) {
+    VoxelOctreeNode child = src[srcChild[i]];
+    if (!child.isLeaf)
+      child.childDescripteOrValue = 0;
+    _octreeNodes.push_back(child);
+  }
+
+  for (int i = 0; i < childCount; i++) {
+    vec3f childLower = octantLower(lower, halfWidth, childOctant[i]);
+    size_t dstChild  = dstID + childOffset + i;
+    if (src[srcChild[i]].isLeaf || depth + 1 == maxDepth) {
+      keptBounds.extend(childLower);
+      keptBounds.extend(childLower + vec3f(halfWidth));
+      if (!src[srcChild[i]].isLeaf)
+        collapsed.push_back({srcChild[i], dstChild});
+    } else {
+      copyRegion(src,
+                 srcChild[i],
+                 dstChild,
+                 childLower,
+                 halfWidth,
+                 roi,
+                 depth + 1,
+                 maxDepth,
+                 keptBounds,
+                 collapsed);
+    }
+  }
+
+  _octreeNodes[dstID].isLeaf = 0;
+  _octreeNodes[dstID].childDescripteOrValue =
+      (childCount ? childOffset << 8 : 0) | newMask;
+}
+
+std::vector<voxel> VoxelOctree::collectLeafVoxels()
+{
+  struct Entry
+  {
+    size_t nodeID;
+    vec3f lower;
+    float width;
+  };
+
+  std::vector<voxel> leaves;
+  std::vector<Entry> stack;
+  stack.push_back({0, _virtualBounds.lower, _virtualBounds.size().x});
+  while (!stack.empty()) {
+    Entry e = stack.back();
+    stack.pop_back();
+
+    VoxelOctreeNode &node = _octreeNodes[e.nodeID];
+    if (node.isLeaf) {
+      leaves.push_back(voxel(_worldOrigin + e.lower * _gridWorldSpace,
+                             e.width * _gridWorldSpace.x,
+                             node.getValue()));
+      continue;
+    }
+
+    const float halfWidth = 0.5f * e.width;
+    for (int i = 7; i >= 0; i--) {
+      if (!(node.getChildMask() & (1 << i)))
+        continue;
+      size_t childID = e.nodeID + node.getChildOffset() +
+                       CHILD_BIT_COUNT[node.getChildMask() & ((1 << i) - 1)];
+      stack.push_back({childID, octantLower(e.lower, halfWidth, i), halfWidth});
+    }
+  }
+  return leaves;
 }
 
 size_t VoxelOctree::buildOctree(size_t nodeID,
@@ -412,7 +1007,7 @@ size_t VoxelOctree::buildOctree(size_t nodeID,
   range1f subVoxelRange[8];
 
   for (size_t i = 0; i < voxelNum; i++) {
-    size_t cVoxelID   = (nodeID == 0) ? i : voxelIDs[i];
+    size_t cVoxelID   = (voxelIDs == NULL) ? i : voxelIDs[i];
     vec3f voxelCenter = this->_voxels[cVoxelID].lower - this->_worldOrigin +
                         0.5 * this->_voxels[cVoxelID].width;
     uint8_t childID = 0;
@@ -475,3 +1070,96 @@ size_t VoxelOctree::buildOctree(size_t nodeID,
   
   return childOffset;
 }
+
+std::vector<VoxelOctreeNode> VoxelOctree::buildSubtree(
+    const box3f &bounds, const std::vector<size_t> &voxelIDs)
+{
+  // buildOctree() appends to _octreeNodes with offsets relative to the
+  // parent, so building into a scratch array yields a relocatable subtree
+  std::vector<VoxelOctreeNode> subtree(1);
+  std::swap(subtree, _octreeNodes);
+  buildOctree(0, bounds, voxelIDs.data(), voxelIDs.size());
+  std::swap(subtree, _octreeNodes);
+  return subtree;
+}
+
+void VoxelOctree::attachSubtree(size_t childIndex,
+                                const std::vector<VoxelOctreeNode> &subtree)
+{
+  // node 0 of the subtree is the root child itself, its children start at
+  // local index 1 which lands on the current end of the node array
+  size_t base = _octreeNodes.size();
+  _octreeNodes[childIndex].childDescripteOrValue =
+      (subtree[0].childDescripteOrValue & 0xFF) | ((base - childIndex) << 8);
+  _octreeNodes.insert(_octreeNodes.end(), subtree.begin() + 1, subtree.end());
+}
+
+void VoxelOctree::buildOctreeFromSubtrees(OctreeSubtreeStore *subtreeStore)
+{
+  const box3f &bounds = _virtualBounds;
+  box3f subBounds[8];
+
+  for (int i = 0; i < 8; i++) {
+    subBounds[i].lower = vec3f((i & 1) ? bounds.center().x : bounds.lower.x,
+                               (i & 2) ? bounds.center().y : bounds.lower.y,
+                               (i & 4) ? bounds.center().z : bounds.lower.z);
+    subBounds[i].upper = subBounds[i].lower + 0.5 * bounds.size().x;
+  }
+
+  vec3f center = bounds.center() * _gridWorldSpace;
+
+  std::vector<size_t> subVoxelIDs[8];
+  range1f subVoxelRange[8];
+
+  for (size_t i = 0; i < vNum; i++) {
+    vec3f voxelCenter =
+        _voxels[i].lower - _worldOrigin + 0.5 * _voxels[i].width;
+    uint8_t childID = 0;
+    childID |= voxelCenter.x < center.x ? 0 : 1;
+    childID |= voxelCenter.y < center.y ? 0 : 2;
+    childID |= voxelCenter.z < center.z ? 0 : 4;
+    subVoxelIDs[childID].push_back(i);
+    subVoxelRange[childID].extend(_voxels[i].value);
+  }
+
+  int childCount = 0;
+  int childIndice[8];
+  uint32_t childMask = 0;
+  for (int i = 0; i < 8; i++) {
+    if (subVoxelIDs[i].size() != 0) {
+      childMask |= 256 >> (8 - i);
+      childIndice[childCount++] = i;
+    }
+  }
+
+  // root children occupy nodes [1, childCount], their subtrees follow
+  for (int i = 0; i < childCount; i++)
+    _octreeNodes.push_back(VoxelOctreeNode());
+
+  for (int i = 0; i < childCount; i++) {
+    int idx           = childIndice[i];
+    size_t childIndex = 1 + i;
+    _octreeNodes[childIndex].vRange = subVoxelRange[idx];
+
+    if (subVoxelIDs[idx].size() == 1) {
+      _octreeNodes[childIndex].isLeaf = 1;
+      _octreeNodes[childIndex].childDescripteOrValue =
+          doulbeBitsToUint((double)_voxels[subVoxelIDs[idx][0]].value);
+      continue;
+    }
+
+    std::vector<VoxelOctreeNode> subtree;
+    if (subtreeStore->loadSubtree(idx, subtree)) {
+      std::cout << "Restored subtree " << idx << " (" << subtree.size()
+                << " nodes) from checkpoint\n";
+    } else {
+      subtree = buildSubtree(subBounds[idx], subVoxelIDs[idx]);
+      subtreeStore->saveSubtree(idx, subtree);
+    }
+    std::vector<size_t>().swap(subVoxelIDs[idx]);
+    attachSubtree(childIndex, subtree);
+  }
+
+  if (vNum > 1)
+    _octreeNodes[0].childDescripteOrValue |= childMask;
+}
@@ -4,6 +4,7 @@
 
 #include <cstdint>
 #include <cstdio>
+#include <memory>
 #include <mutex>
 
 #include "ospray/ospray.h"
@@ -35,6 +36,41 @@ static inline uint64_t doulbeBitsToUint(double f) {
 }
 
 
+// spread the lower 21 bits of x so that two zero bits follow each bit
+static inline uint64_t expandBits21(uint64_t x)
+{
+  x &= 0x1fffff;
+  x = (x | x << 32) & 0x1f00000000ffffull;
+  x = (x | x << 16) & 0x1f0000ff0000ffull;
+  x = (x | x << 8) & 0x100f00f00f00f00full;
+  x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+  x = (x | x << 2) & 0x1249249249249249ull;
+  return x;
+}
+
+static inline uint64_t compactBits21(uint64_t x)
+{
+  x &= 0x1249249249249249ull;
+  x = (x | x >> 2) & 0x10c30c30c30c30c3ull;
+  x = (x | x >> 4) & 0x100f00f00f00f00full;
+  x = (x | x >> 8) & 0x1f0000ff0000ffull;
+  x = (x | x >> 16) & 0x1f00000000ffffull;
+  x = (x | x >> 32) & 0x1fffff;
+  return x;
+}
+
+//! 63 bit Morton key, x in the lowest bit of every octant digit like the
+//! child masks of the octree
+static inline uint64_t mortonKey(const vec3i &p)
+{
+  return expandBits21(p.x) | expandBits21(p.y) << 1 | expandBits21(p.z) << 2;
+}
+
+static inline vec3i mortonDecode(uint64_t key)
+{
+  return vec3i(compactBits21(key), compactBits21(key >> 1), compactBits21(key >> 2));
+}
+
 static inline int roundToPow2(int x) {
     int y;
     for (y = 1; y < x; y *= 2);
@@ -85,6 +121,31 @@ struct voxel{
     }
 };
 
+/*! AMR cell on an integer grid, as stored in the exajet hexahedron files:
+ * the lower corner in units of the level 0 cells and a width of
+ * (1 << level) of them */
+struct OctreeCell
+{
+  vec3i lower;
+  int level;
+
+  //! lower corner on an octree grid whose cells are 1 << minLevel wide
+  vec3i gridLower(const vec3i &gridMin, int minLevel) const
+  {
+    const vec3i p = lower - gridMin;
+    return vec3i(p.x >> minLevel, p.y >> minLevel, p.z >> minLevel);
+  }
+};
+
+//! cell of the integer build, ordered by the Morton key of its lower corner
+struct MortonCell
+{
+  uint64_t key;
+  float value;
+
+  bool operator<(const MortonCell &other) const { return key < other.key; }
+};
+
 struct VoxelOctreeNode
 {
   // Store the value range of current node, used for fast isosurface generation
@@ -105,6 +166,19 @@ struct VoxelOctreeNode
 };
 
 
+/*! persistence hooks used to resume an interrupted octree build. The
+ * descendants of every child of the root are built as independent subtrees,
+ * so each one can be stored once it is finished and restored on a rerun. */
+struct OctreeSubtreeStore
+{
+  virtual ~OctreeSubtreeStore() {}
+  //! restore the subtree below root child 'octant'; false if not available
+  virtual bool loadSubtree(int octant, std::vector<VoxelOctreeNode> &nodes) = 0;
+  //! persist the finished subtree below root child 'octant'
+  virtual void saveSubtree(int octant,
+                           const std::vector<VoxelOctreeNode> &nodes) = 0;
+};
+
 class VoxelOctree{
 public:
  VoxelOctree(){};
@@ -116,15 +190,83 @@ public:
              range1f voxelRange,
              box3f actualBounds,
              vec3f gridWorldSpace,
-             vec3f worldOrigin);
+             vec3f worldOrigin,
+             OctreeSubtreeStore *subtreeStore = NULL);
+
+ /*! build straight from integer cells, e.g. the mmapped exajet hexahedra.
+  * On the octree grid cell i covers (lower - gridMin) >> minLevel with a
+  * width of 1 << (level - minLevel) and holds values[i]. The cells are
+  * sorted by the Morton key of their lower corner, so every node owns a
+  * contiguous run of them and no float positions are ever rounded. */
+ VoxelOctree(const OctreeCell *cells,
+             const float *values,
+             const size_t cellNum,
+             const vec3i &gridMin,
+             int minLevel,
+             box3f actualBounds,
+             vec3f gridWorldSpace,
+             vec3f worldOrigin,
+             OctreeSubtreeStore *subtreeStore = NULL);
 
  void printOctree();
  void printOctreeNode(const size_t nodeID);
  void saveOctree(const std::string &fileName);
+ //! write only the .oct description of a tree with nodeNum nodes
+ void saveOctreeHeader(const std::string &octFile, size_t nodeNum);
  void mapOctreeFromFile(const std::string &fileName);
 
  double queryData(vec3f pos);
 
+ /*! rewrite the leaf values from a voxel array with the same cells the tree
+  * was built from (e.g. another field of the same mesh), and refresh the
+  * value ranges of all inner nodes. The topology is left untouched. */
+ void updateLeafValues(const voxel *voxels, const size_t voxelNum);
+ //! same for a tree built from integer cells
+ void updateLeafValues(const OctreeCell *cells,
+                       const float *values,
+                       const size_t cellNum,
+                       const vec3i &gridMin,
+                       int minLevel);
+ //! recompute the value range of every inner node from its children
+ static void updateNodeRanges(std::vector<VoxelOctreeNode> &nodes);
+
+ /*! crop the cells overlapping 'roi' (grid space) into a new octree. The
+  * result is re-rooted at the smallest node enclosing the region and its
+  * grid starts at that node, _worldOrigin is shifted accordingly. Cells
+  * are kept whole, they are never split at the region boundary. With
+  * maxDepth >= 0 every inner node at that depth below the new root is
+  * collapsed into a leaf holding the volume-weighted average of its cells,
+  * so maxDepth = 0 leaves the new root as the only leaf. A negative maxDepth
+  * keeps the full resolution. */
+ std::shared_ptr<VoxelOctree> extractRegion(const box3f &roi, int maxDepth = -1);
+ //! same as extractRegion(), but only pages in the overlapping subtrees of
+ //! a saved octree instead of loading the whole file
+ static std::shared_ptr<VoxelOctree> extractRegionFromFile(
+     const std::string &octFile,
+     const vec3f &worldOrigin,
+     const box3f &roi,
+     int maxDepth = -1);
+ //! lower resolution copy of the whole tree, see extractRegion()
+ std::shared_ptr<VoxelOctree> coarsen(int maxDepth);
+
+ /*! split the Morton-sorted cells [begin, end) of a node into its octants,
+  * whose digit sits at bit 3 * level of the keys. octantBegin[8] is end. */
+ static void partitionOctants(const MortonCell *begin,
+                              const MortonCell *end,
+                              int level,
+                              const MortonCell *octantBegin[9]);
+ /*! append the children of nodes[nodeID], which owns the sorted cells
+  * [begin, end), in the node order of buildOctree(): all children first,
+  * then the subtree of each child. Returns the value range of the node. */
+ static range1f buildSortedSubtree(std::vector<VoxelOctreeNode> &nodes,
+                                   size_t nodeID,
+                                   const MortonCell *begin,
+                                   const MortonCell *end,
+                                   int level);
+
+ //! all leaves as world space voxels, e.g. to write a matching .vxl file
+ std::vector<voxel> collectLeafVoxels();
+
  box3f _actualBounds;
  //! extend the dimension to pow of 2 to build the octree e.g. 4 x 4 x 4
  box3f _virtualBounds;
@@ -144,7 +286,55 @@ private:
   size_t buildOctree(size_t nodeID,const box3f& bounds, std::vector<voxel> &voxels);
   // size_t buildOctree(size_t nodeID,const box3f& bounds, const voxel* voxels, const size_t voxelNum);
   size_t buildOctree(size_t nodeID,const box3f& bounds, const size_t* voxelIDs, const size_t voxelNum);
-
+  //! build the root level, then each root child's subtree through the store
+  void buildOctreeFromSubtrees(OctreeSubtreeStore *subtreeStore);
+  //! build a standalone subtree whose root is node 0 of the returned array
+  std::vector<VoxelOctreeNode> buildSubtree(const box3f &bounds,
+                                            const std::vector<size_t> &voxelIDs);
+  //! append a relocatable subtree below the root child at childIndex
+  void attachSubtree(size_t childIndex,
+                     const std::vector<VoxelOctreeNode> &subtree);
+  //! descend to the leaf containing 'pos' (grid space), -1 if there is none
+  size_t findLeafNode(const vec3f &pos);
+  //! node on the path from the root to a leaf
+  struct PathEntry
+  {
+    size_t nodeID;
+    vec3f lower;
+    float width;
+  };
+  //! findLeafNode() for a sequence of nearby points: starts from the deepest
+  //! node on 'path' that contains pos and leaves the new path in it
+  size_t findLeafNode(const vec3f &pos, std::vector<PathEntry> &path);
+  //! read the .oct header into the bounds, returns the number of nodes
+  size_t readOctreeHeader(const std::string &fileName);
+
+  static std::shared_ptr<VoxelOctree> extractRegion(
+      const VoxelOctreeNode *nodes,
+      const box3f &actualBounds,
+      const box3f &virtualBounds,
+      const vec3f &gridWorldSpace,
+      const vec3f &worldOrigin,
+      const box3f &roi,
+      int maxDepth);
+  //! inner node of the source tree that becomes a leaf of the copy
+  struct CollapsedNode
+  {
+    size_t srcID;
+    size_t dstID;
+  };
+  /*! append the children of src[srcID] overlapping 'roi' below dstID, inner
+   * children at maxDepth are only recorded in 'collapsed' */
+  void copyRegion(const VoxelOctreeNode *src,
+                  size_t srcID,
+                  size_t dstID,
+                  const vec3f &lower,
+                  float width,
+                  const box3f &roi,
+                  int depth,
+                  int maxDepth,
+                  box3f &keptBounds,
+                  std::vector<CollapsedNode> &collapsed);
 };
 
 #endif